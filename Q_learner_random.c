@@ -88,14 +88,14 @@ void* thread_function(void *arg) {
     ThreadArg *thread_arg = (ThreadArg *)arg;
     Experience *dataset = thread_arg->dataset;
 
-    //unsigned int rand_seed = 42;
+    unsigned int rand_seed = 42;
 
     for (int episode = 0; episode < NUM_EPISODES; episode++) {
         int start_index = thread_arg->start_index;
         int end_index = thread_arg->end_index;  // Corrected line
 
         for (int i = start_index; i < end_index; i++) {
-            int random_index = rand() % ((end_index - start_index) + start_index);
+            int random_index = custom_rand(&rand_seed) % ((end_index - start_index) + start_index);
             update_q_table(dataset[random_index]);
         }
     }
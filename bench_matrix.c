@@ -0,0 +1,337 @@
+// Benchmark matrix for threaded_Baseline
+//
+// Generates one random-MDP dataset per table size with gen_experiences, then
+// runs threaded_Baseline for every sampling x algorithm x thread count
+// combination: warm-up runs first, then timed trials. Throughput is the
+// training-phase updates/sec from each run's --report. One CSV row per
+// combination; rows keep a fixed column order so two builds' files diff
+// cleanly, and --compare flags combinations that got slower.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAX_ITEMS 16            // Entries per comma-separated list
+#define MAX_TRIALS 100
+#define MAX_ROWS 4096           // Rows read from a --compare baseline
+#define DEFAULT_SAMPLES 1000000
+#define DEFAULT_EPISODES 20
+#define DEFAULT_WARMUP 1
+#define DEFAULT_TRIALS 5
+#define DEFAULT_TOLERANCE 0.05  // Relative median drop that counts as a regression
+
+typedef struct {
+    char sampling[16];
+    char algorithm[16];
+    int threads;
+    int states;
+    int actions;
+    long samples;
+    int episodes;
+    double median;
+    double ci_low;
+    double ci_high;
+} Row;
+
+// Two-sided 95% Student t quantiles for 1..30 degrees of freedom
+const double t95[31] = { 0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                         2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                         2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+
+// Split a comma-separated list in place; returns the number of items
+int split_list(char* str, char* items[MAX_ITEMS]) {
+    int n = 0;
+    for (char* token = strtok(str, ","); token != NULL && n < MAX_ITEMS; token = strtok(NULL, ","))
+        items[n++] = token;
+    return n;
+}
+
+// Run argv[0] with stdout sent to /dev/null; returns its exit status
+int run_quiet(char* const argv[]) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+            close(null_fd);
+        }
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+        return -1;
+    return WEXITSTATUS(status);
+}
+
+// Whole-run updates_per_second from a CSV report, or -1
+double read_throughput(const char* report_path) {
+    FILE* file = fopen(report_path, "r");
+    if (file == NULL)
+        return -1;
+    char line[1024];
+    double value = -1;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        // dataset,sampling,algorithm,metric,thread,value
+        char* metric = strstr(line, ",updates_per_second,,");
+        if (metric != NULL)
+            value = atof(metric + strlen(",updates_per_second,,"));
+    }
+    fclose(file);
+    return value;
+}
+
+int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted values
+double percentile(const double* sorted, int n, double p) {
+    int rank = (int)ceil(p * n);
+    if (rank < 1)
+        rank = 1;
+    return sorted[rank - 1];
+}
+
+int load_baseline(const char* path, Row* rows) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    char line[1024];
+    int n = 0;
+    while (n < MAX_ROWS && fgets(line, sizeof(line), file) != NULL) {
+        Row* r = &rows[n];
+        // label,sampling,algorithm,threads,states,actions,samples,episodes,trials,median,p95,mean,ci95_low,ci95_high
+        if (sscanf(line, "%*[^,],%15[^,],%15[^,],%d,%d,%d,%ld,%d,%*d,%lf,%*f,%*f,%lf,%lf", r->sampling, r->algorithm,
+                   &r->threads, &r->states, &r->actions, &r->samples, &r->episodes, &r->median, &r->ci_low, &r->ci_high) == 10)
+            n++;
+    }
+    fclose(file);
+    return n;
+}
+
+const Row* find_row(const Row* rows, int n, const Row* key) {
+    for (int i = 0; i < n; i++) {
+        if (strcmp(rows[i].sampling, key->sampling) == 0 && strcmp(rows[i].algorithm, key->algorithm) == 0 &&
+            rows[i].threads == key->threads && rows[i].states == key->states && rows[i].actions == key->actions &&
+            rows[i].samples == key->samples && rows[i].episodes == key->episodes)
+            return &rows[i];
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <threaded_Baseline binary> <output.csv> [options]\n", argv[0]);
+        fprintf(stderr, "Options:\n");
+        fprintf(stderr, "  --gen=<path>                 gen_experiences binary (default ./gen_experiences)\n");
+        fprintf(stderr, "  --samplings=<list>           default SEQUENTIAL,RANDOM,STRIDE\n");
+        fprintf(stderr, "  --algorithms=<list>          default QLEARN,SARSA\n");
+        fprintf(stderr, "  --threads=<list>             default 1,2,4,8,16\n");
+        fprintf(stderr, "  --sizes=<SxA,...>            random-MDP table sizes (default 500x16)\n");
+        fprintf(stderr, "  --samples=<N>                samples per dataset (default %d)\n", DEFAULT_SAMPLES);
+        fprintf(stderr, "  --episodes=<E>               passes per run (default %d)\n", DEFAULT_EPISODES);
+        fprintf(stderr, "  --warmup=<W> --trials=<T>    untimed and timed runs per combination (default %d, %d)\n", DEFAULT_WARMUP, DEFAULT_TRIALS);
+        fprintf(stderr, "  --label=<name>               build label for the first CSV column (default \"build\")\n");
+        fprintf(stderr, "  --workdir=<dir>              where datasets and reports go (default /tmp)\n");
+        fprintf(stderr, "  --compare=<baseline.csv>     flag rows whose median dropped by more than --tolerance\n");
+        fprintf(stderr, "  --tolerance=<x>              (default %g) with non-overlapping 95%% intervals; exit status 2 if any\n", DEFAULT_TOLERANCE);
+        return EXIT_FAILURE;
+    }
+
+    char* binary = argv[1];
+    char* output_path = argv[2];
+    char* gen = "./gen_experiences";
+    char samplings_str[256] = "SEQUENTIAL,RANDOM,STRIDE";
+    char algorithms_str[256] = "QLEARN,SARSA";
+    char threads_str[256] = "1,2,4,8,16";
+    char sizes_str[256] = "500x16";
+    long samples = DEFAULT_SAMPLES;
+    int episodes = DEFAULT_EPISODES;
+    int warmup = DEFAULT_WARMUP;
+    int trials = DEFAULT_TRIALS;
+    char* label = "build";
+    char* workdir = "/tmp";
+    char* compare_path = NULL;
+    double tolerance = DEFAULT_TOLERANCE;
+
+    for (int i = 3; i < argc; i++) {
+        if (strncmp(argv[i], "--gen=", 6) == 0) {
+            gen = argv[i] + 6;
+        } else if (strncmp(argv[i], "--samplings=", 12) == 0) {
+            snprintf(samplings_str, sizeof(samplings_str), "%s", argv[i] + 12);
+        } else if (strncmp(argv[i], "--algorithms=", 13) == 0) {
+            snprintf(algorithms_str, sizeof(algorithms_str), "%s", argv[i] + 13);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            snprintf(threads_str, sizeof(threads_str), "%s", argv[i] + 10);
+        } else if (strncmp(argv[i], "--sizes=", 8) == 0) {
+            snprintf(sizes_str, sizeof(sizes_str), "%s", argv[i] + 8);
+        } else if (strncmp(argv[i], "--samples=", 10) == 0) {
+            samples = atol(argv[i] + 10);
+        } else if (strncmp(argv[i], "--episodes=", 11) == 0) {
+            episodes = atoi(argv[i] + 11);
+        } else if (strncmp(argv[i], "--warmup=", 9) == 0) {
+            warmup = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--trials=", 9) == 0) {
+            trials = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--label=", 8) == 0) {
+            label = argv[i] + 8;
+        } else if (strncmp(argv[i], "--workdir=", 10) == 0) {
+            workdir = argv[i] + 10;
+        } else if (strncmp(argv[i], "--compare=", 10) == 0) {
+            compare_path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--tolerance=", 12) == 0) {
+            tolerance = atof(argv[i] + 12);
+        } else {
+            fprintf(stderr, "Invalid option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (samples < 1 || episodes < 1 || warmup < 0 || trials < 1 || trials > MAX_TRIALS || strchr(label, ',') != NULL) {
+        fprintf(stderr, "Invalid arguments\n");
+        return EXIT_FAILURE;
+    }
+
+    char *samplings[MAX_ITEMS], *algorithms[MAX_ITEMS], *thread_counts[MAX_ITEMS], *sizes[MAX_ITEMS];
+    int num_samplings = split_list(samplings_str, samplings);
+    int num_algorithms = split_list(algorithms_str, algorithms);
+    int num_thread_counts = split_list(threads_str, thread_counts);
+    int num_sizes = split_list(sizes_str, sizes);
+
+    Row* baseline = NULL;
+    int num_baseline = 0;
+    if (compare_path != NULL) {
+        baseline = (Row*)malloc(MAX_ROWS * sizeof(Row));
+        if (baseline == NULL) {
+            perror("Error allocating memory for the baseline");
+            return 1;
+        }
+        num_baseline = load_baseline(compare_path, baseline);
+        if (num_baseline < 0)
+            return 1;
+    }
+
+    FILE* out = fopen(output_path, "w");
+    if (out == NULL) {
+        perror(output_path);
+        return 1;
+    }
+    fprintf(out, "label,sampling,algorithm,threads,states,actions,samples,episodes,trials,"
+                 "median_updates_per_second,p95_updates_per_second,mean_updates_per_second,ci95_low,ci95_high\n");
+
+    char report_path[512], dataset_path[512], samples_arg[32], episodes_arg[32], report_arg[600];
+    snprintf(report_path, sizeof(report_path), "%s/bench_matrix_%d.csv", workdir, (int)getpid());
+    snprintf(samples_arg, sizeof(samples_arg), "%ld", samples);
+    snprintf(episodes_arg, sizeof(episodes_arg), "--episodes=%d", episodes);
+    snprintf(report_arg, sizeof(report_arg), "--report=%s", report_path);
+    int regressions = 0;
+
+    for (int z = 0; z < num_sizes; z++) {
+        int states, actions;
+        if (sscanf(sizes[z], "%dx%d", &states, &actions) != 2) {
+            fprintf(stderr, "Invalid size: %s\n", sizes[z]);
+            return EXIT_FAILURE;
+        }
+        char states_arg[32], actions_arg[32], states_num[16], actions_num[16];
+        snprintf(states_arg, sizeof(states_arg), "--states=%d", states);
+        snprintf(actions_arg, sizeof(actions_arg), "--actions=%d", actions);
+        snprintf(states_num, sizeof(states_num), "%d", states);
+        snprintf(actions_num, sizeof(actions_num), "%d", actions);
+        snprintf(dataset_path, sizeof(dataset_path), "%s/bench_matrix_%dx%d_%ld.qexp", workdir, states, actions, samples);
+
+        char* gen_argv[] = { gen, "RANDOM", samples_arg, dataset_path, "--format=BINARY", states_arg, actions_arg, NULL };
+        if (run_quiet(gen_argv) != 0) {
+            fprintf(stderr, "Dataset generation failed for %s\n", sizes[z]);
+            return 1;
+        }
+
+        for (int s = 0; s < num_samplings; s++) {
+            for (int a = 0; a < num_algorithms; a++) {
+                for (int t = 0; t < num_thread_counts; t++) {
+                    char threads_arg[32];
+                    snprintf(threads_arg, sizeof(threads_arg), "--threads=%s", thread_counts[t]);
+                    char* run_argv[] = { binary, dataset_path, states_num, actions_num, samples_arg, samplings[s], algorithms[a],
+                                         threads_arg, episodes_arg, "--print=NONE", report_arg, "--report-format=CSV", NULL };
+
+                    double values[MAX_TRIALS];
+                    int failed = 0;
+                    for (int r = 0; r < warmup + trials && !failed; r++) {
+                        remove(report_path);
+                        double ups = run_quiet(run_argv) == 0 ? read_throughput(report_path) : -1;
+                        if (ups < 0)
+                            failed = 1;
+                        else if (r >= warmup)
+                            values[r - warmup] = ups;
+                    }
+                    if (failed) {
+                        fprintf(stderr, "Run failed: %s %s %s threads=%s size=%s\n", binary, samplings[s], algorithms[a],
+                                thread_counts[t], sizes[z]);
+                        continue;
+                    }
+
+                    double mean = 0.0, var = 0.0;
+                    for (int r = 0; r < trials; r++)
+                        mean += values[r];
+                    mean /= trials;
+                    for (int r = 0; r < trials; r++)
+                        var += (values[r] - mean) * (values[r] - mean);
+                    double half = 0.0;
+                    if (trials > 1)
+                        half = (trials - 1 <= 30 ? t95[trials - 1] : 1.96) * sqrt(var / (trials - 1)) / sqrt(trials);
+                    qsort(values, trials, sizeof(double), compare_doubles);
+                    // Throughput of the slowest 5% of trials
+                    double p95 = percentile(values, trials, 0.05);
+
+                    Row row;
+                    snprintf(row.sampling, sizeof(row.sampling), "%s", samplings[s]);
+                    snprintf(row.algorithm, sizeof(row.algorithm), "%s", algorithms[a]);
+                    row.threads = atoi(thread_counts[t]);
+                    row.states = states;
+                    row.actions = actions;
+                    row.samples = samples;
+                    row.episodes = episodes;
+                    row.median = percentile(values, trials, 0.5);
+                    row.ci_low = mean - half;
+                    row.ci_high = mean + half;
+
+                    fprintf(out, "%s,%s,%s,%d,%d,%d,%ld,%d,%d,%.1f,%.1f,%.1f,%.1f,%.1f\n", label, row.sampling, row.algorithm,
+                            row.threads, states, actions, samples, episodes, trials, row.median, p95, mean, row.ci_low, row.ci_high);
+                    fflush(out);
+                    printf("%-10s %-6s threads=%-3d %dx%d: median %.3g updates/s (95%% CI %.3g..%.3g)\n", row.sampling,
+                           row.algorithm, row.threads, states, actions, row.median, row.ci_low, row.ci_high);
+
+                    const Row* base = baseline != NULL ? find_row(baseline, num_baseline, &row) : NULL;
+                    if (base != NULL && base->median > 0) {
+                        double change = row.median / base->median - 1.0;
+                        if (change < -tolerance && row.ci_high < base->ci_low) {
+                            printf("REGRESSION: %s %s threads=%d %dx%d: median %.3g -> %.3g (%+.1f%%)\n", row.sampling,
+                                   row.algorithm, row.threads, states, actions, base->median, row.median, change * 100);
+                            regressions++;
+                        }
+                    }
+                }
+            }
+        }
+        remove(dataset_path);
+    }
+
+    remove(report_path);
+    fclose(out);
+    free(baseline);
+    if (compare_path != NULL)
+        printf("%d regression(s) against %s\n", regressions, compare_path);
+    return regressions > 0 ? 2 : 0;
+}
@@ -0,0 +1,438 @@
+// Synthetic experience generator for the Q-learning benchmarks
+//
+// Rolls out a uniform random behaviour policy in a built-in environment and
+// writes the transitions in the text format ("state action reward
+// next_state [next_action]", blank line between episodes) or the binary
+// format of qlearn_formats.h. Output depends only on the environment, its
+// parameters, the sample count and --seed, not on --threads: samples are
+// produced in fixed blocks, each seeded from (seed, block index), and
+// written in block order.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+
+#include "qlearn_formats.h"
+#include "qlearn_env.h"
+
+#define BLOCK_SAMPLES 65536     // Samples per independently seeded block; every block starts a new episode
+#define MAX_LINE 64             // Longest text line for one sample
+#define MAX_THREADS 64
+#define DEFAULT_SEED 42
+#define RANDOM_STATES 500
+#define RANDOM_ACTIONS 16
+#define RANDOM_BRANCHING 4
+#define RANDOM_SPARSITY 0.9     // Fraction of transitions with zero reward
+#define RANDOM_EPISODE_LENGTH 100
+
+typedef enum {
+    FROZENLAKE = 0,
+    TAXI,
+    RANDOM_MDP
+} environment;
+
+typedef enum {
+    TEXT = 0,
+    BINARY
+} output_format;
+
+// One transition; rewards are kept in hundredths so text output needs no
+// floating-point formatting
+typedef struct {
+    int state;
+    int action;
+    int reward_centi;
+    int next_state;
+    int next_action;
+} Transition;
+
+environment env_type = FROZENLAKE;
+output_format format_type = TEXT;
+int log_next_action = 0;
+uint64_t base_seed = DEFAULT_SEED;
+int num_states;
+int num_actions;
+int episode_limit;
+
+// FrozenLake (qlearn_env.h)
+int lake_size = 4;
+int slippery = 1;
+
+// Random MDP: (s, a) moves to one of branching successors chosen uniformly;
+// successors and start states follow a Zipf(zipf_s) distribution over states
+int branching = RANDOM_BRANCHING;
+double sparsity = RANDOM_SPARSITY;
+double zipf_s = 0.0;
+int* mdp_next;          // [state][action][branch]
+int* mdp_reward;        // Hundredths, same layout
+double* zipf_cdf;       // NULL for uniform
+
+// Block scheduling and in-order output
+long total_samples;
+long num_blocks;
+atomic_long next_block = 0;
+long next_to_write = 0;
+pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t write_cond = PTHREAD_COND_INITIALIZER;
+int out_fd;
+int write_failed = 0;
+
+int zipf_state(uint64_t* rng) {
+    if (zipf_cdf == NULL)
+        return qenv_rand_below(rng, num_states);
+    double u = qenv_rand_unit(rng);
+    int lo = 0, hi = num_states - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int random_mdp_step(uint64_t* rng, int state, int action, int* next_state, int* reward_centi) {
+    size_t slot = ((size_t)state * num_actions + action) * branching + qenv_rand_below(rng, branching);
+    *next_state = mdp_next[slot];
+    *reward_centi = mdp_reward[slot];
+    return 0;
+}
+
+int reset_state(uint64_t* rng) {
+    if (env_type == TAXI)
+        return qenv_taxi_reset(rng);
+    if (env_type == RANDOM_MDP)
+        return zipf_state(rng);
+    return 0;
+}
+
+// Environment step: returns 1 when next_state is terminal
+int env_step(uint64_t* rng, int state, int action, int* next_state, int* reward_centi) {
+    if (env_type == FROZENLAKE)
+        return qenv_frozenlake_step(rng, lake_size, slippery, state, action, next_state, reward_centi);
+    if (env_type == TAXI)
+        return qenv_taxi_step(state, action, next_state, reward_centi);
+    return random_mdp_step(rng, state, action, next_state, reward_centi);
+}
+
+// Roll out one block of samples; episode_end[i] marks samples that end an
+// episode, which the text format follows with a blank line
+void generate_block(long block, Transition* out, int n, unsigned char* episode_end) {
+    uint64_t mix = base_seed ^ ((uint64_t)block * 0xD1B54A32D192ED03ULL);
+    uint64_t rng = qenv_splitmix64(&mix) | 1;
+
+    int state = reset_state(&rng);
+    int action = qenv_rand_below(&rng, num_actions);
+    int steps = 0;
+    for (int i = 0; i < n; i++) {
+        int next_state, reward_centi;
+        int terminal = env_step(&rng, state, action, &next_state, &reward_centi);
+        int next_action = qenv_rand_below(&rng, num_actions);
+        steps++;
+        int done = terminal || steps == episode_limit;
+
+        out[i].state = state;
+        out[i].action = action;
+        out[i].reward_centi = reward_centi;
+        out[i].next_state = next_state;
+        out[i].next_action = log_next_action && !terminal ? next_action : -1;
+        episode_end[i] = (unsigned char)done;
+
+        if (done) {
+            state = reset_state(&rng);
+            action = qenv_rand_below(&rng, num_actions);
+            steps = 0;
+        } else {
+            state = next_state;
+            action = next_action;
+        }
+    }
+}
+
+size_t format_text(const Transition* t, const unsigned char* episode_end, int n, char* buffer) {
+    char* p = buffer;
+    for (int i = 0; i < n; i++) {
+        p = qformat_int(p, t[i].state);
+        *p++ = ' ';
+        p = qformat_int(p, t[i].action);
+        *p++ = ' ';
+        int centi = t[i].reward_centi;
+        if (centi < 0) {
+            *p++ = '-';
+            centi = -centi;
+        }
+        p = qformat_int(p, centi / 100);
+        *p++ = '.';
+        *p++ = (char)('0' + centi / 10 % 10);
+        *p++ = (char)('0' + centi % 10);
+        *p++ = ' ';
+        p = qformat_int(p, t[i].next_state);
+        if (log_next_action) {
+            *p++ = ' ';
+            p = qformat_int(p, t[i].next_action);
+        }
+        *p++ = '\n';
+        if (episode_end[i])
+            *p++ = '\n';
+    }
+    return (size_t)(p - buffer);
+}
+
+size_t format_binary(const Transition* t, int n, char* buffer) {
+    QExperience* out = (QExperience*)buffer;
+    for (int i = 0; i < n; i++) {
+        out[i].state = t[i].state;
+        out[i].action = t[i].action;
+        out[i].reward = t[i].reward_centi / 100.0;
+        out[i].next_state = t[i].next_state;
+        out[i].next_action = t[i].next_action;
+    }
+    return (size_t)n * sizeof(QExperience);
+}
+
+int write_all(int fd, const char* p, size_t bytes) {
+    while (bytes > 0) {
+        ssize_t written = write(fd, p, bytes);
+        if (written < 0)
+            return 1;
+        p += written;
+        bytes -= (size_t)written;
+    }
+    return 0;
+}
+
+void* generator_thread(void* arg) {
+    (void)arg;
+    Transition* transitions = (Transition*)malloc(BLOCK_SAMPLES * sizeof(Transition));
+    unsigned char* episode_end = (unsigned char*)malloc(BLOCK_SAMPLES);
+    char* buffer = (char*)malloc((size_t)BLOCK_SAMPLES * MAX_LINE);
+    if (transitions == NULL || episode_end == NULL || buffer == NULL) {
+        perror("Error allocating memory for generator buffers");
+        exit(EXIT_FAILURE);
+    }
+
+    for (;;) {
+        long block = atomic_fetch_add(&next_block, 1);
+        if (block >= num_blocks)
+            break;
+        long first = block * BLOCK_SAMPLES;
+        int n = (int)(total_samples - first < BLOCK_SAMPLES ? total_samples - first : BLOCK_SAMPLES);
+
+        generate_block(block, transitions, n, episode_end);
+        size_t bytes = format_type == TEXT ? format_text(transitions, episode_end, n, buffer) : format_binary(transitions, n, buffer);
+
+        // Blocks are formatted in parallel and written in order
+        pthread_mutex_lock(&write_lock);
+        while (next_to_write != block)
+            pthread_cond_wait(&write_cond, &write_lock);
+        pthread_mutex_unlock(&write_lock);
+        if (!write_failed && write_all(out_fd, buffer, bytes) != 0) {
+            perror("Error writing output");
+            write_failed = 1;
+        }
+        pthread_mutex_lock(&write_lock);
+        next_to_write++;
+        pthread_cond_broadcast(&write_cond);
+        pthread_mutex_unlock(&write_lock);
+    }
+
+    free(transitions);
+    free(episode_end);
+    free(buffer);
+    return NULL;
+}
+
+// Successors and rewards of the random MDP, drawn from base_seed alone
+int build_random_mdp(void) {
+    size_t slots = (size_t)num_states * num_actions * branching;
+    mdp_next = (int*)malloc(slots * sizeof(int));
+    mdp_reward = (int*)malloc(slots * sizeof(int));
+    if (mdp_next == NULL || mdp_reward == NULL) {
+        perror("Error allocating memory for the random MDP");
+        return 1;
+    }
+    if (zipf_s > 0) {
+        zipf_cdf = (double*)malloc(num_states * sizeof(double));
+        if (zipf_cdf == NULL) {
+            perror("Error allocating memory for the Zipf table");
+            return 1;
+        }
+        double sum = 0.0;
+        for (int s = 0; s < num_states; s++) {
+            sum += pow(s + 1, -zipf_s);
+            zipf_cdf[s] = sum;
+        }
+        for (int s = 0; s < num_states; s++)
+            zipf_cdf[s] /= sum;
+    }
+
+    uint64_t mix = base_seed;
+    uint64_t rng = qenv_splitmix64(&mix) | 1;
+    for (size_t slot = 0; slot < slots; slot++) {
+        mdp_next[slot] = zipf_state(&rng);
+        mdp_reward[slot] = 0;
+        if (qenv_rand_unit(&rng) >= sparsity) {
+            int r = qenv_rand_below(&rng, 200);  // Nonzero hundredths in [-1, 1]
+            mdp_reward[slot] = r < 100 ? r - 100 : r - 99;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <FROZENLAKE|TAXI|RANDOM> <num_samples> <output_path> [options]\n", argv[0]);
+        fprintf(stderr, "Options:\n");
+        fprintf(stderr, "  --format=TEXT|BINARY      text lines or the binary format of qlearn_formats.h (default TEXT)\n");
+        fprintf(stderr, "  --threads=<N>             generator threads, 1..%d (default: online cores)\n", MAX_THREADS);
+        fprintf(stderr, "  --seed=<S>                base seed (default %d)\n", DEFAULT_SEED);
+        fprintf(stderr, "  --next-action             log a_{t+1} as a fifth field (for SARSALOGGED)\n");
+        fprintf(stderr, "  --map=4x4|8x8             FrozenLake map (default 4x4)\n");
+        fprintf(stderr, "  --slippery=0|1            FrozenLake slippery ice (default 1)\n");
+        fprintf(stderr, "  --states=<S> --actions=<A> --branching=<B>  random MDP size (default %d x %d, %d successors)\n",
+                RANDOM_STATES, RANDOM_ACTIONS, RANDOM_BRANCHING);
+        fprintf(stderr, "  --sparsity=<x>            random MDP: fraction of zero-reward transitions (default %g)\n", RANDOM_SPARSITY);
+        fprintf(stderr, "  --zipf=<s>                random MDP: Zipf exponent of successor/start states (default 0, uniform)\n");
+        fprintf(stderr, "  --episode-length=<L>      random MDP episode length (default %d)\n", RANDOM_EPISODE_LENGTH);
+        return EXIT_FAILURE;
+    }
+
+    char* env_str = argv[1];
+    total_samples = atol(argv[2]);
+    char* output_path = argv[3];
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_threads = online < 1 ? 1 : (online > MAX_THREADS ? MAX_THREADS : (int)online);
+    num_states = RANDOM_STATES;
+    num_actions = RANDOM_ACTIONS;
+    episode_limit = RANDOM_EPISODE_LENGTH;
+
+    if (strcmp(env_str, "FROZENLAKE") == 0) {
+        env_type = FROZENLAKE;
+    } else if (strcmp(env_str, "TAXI") == 0) {
+        env_type = TAXI;
+    } else if (strcmp(env_str, "RANDOM") == 0) {
+        env_type = RANDOM_MDP;
+    } else {
+        fprintf(stderr, "Invalid environment: %s\n", env_str);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 4; i < argc; i++) {
+        if (strncmp(argv[i], "--format=", 9) == 0) {
+            if (strcmp(argv[i] + 9, "TEXT") == 0) {
+                format_type = TEXT;
+            } else if (strcmp(argv[i] + 9, "BINARY") == 0) {
+                format_type = BINARY;
+            } else {
+                fprintf(stderr, "Invalid format: %s\n", argv[i] + 9);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            num_threads = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            base_seed = strtoull(argv[i] + 7, NULL, 10);
+        } else if (strcmp(argv[i], "--next-action") == 0) {
+            log_next_action = 1;
+        } else if (strncmp(argv[i], "--map=", 6) == 0) {
+            if (strcmp(argv[i] + 6, "4x4") == 0) {
+                lake_size = 4;
+            } else if (strcmp(argv[i] + 6, "8x8") == 0) {
+                lake_size = 8;
+            } else {
+                fprintf(stderr, "Invalid map: %s\n", argv[i] + 6);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--slippery=", 11) == 0) {
+            slippery = atoi(argv[i] + 11) != 0;
+        } else if (strncmp(argv[i], "--states=", 9) == 0) {
+            num_states = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--actions=", 10) == 0) {
+            num_actions = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--branching=", 12) == 0) {
+            branching = atoi(argv[i] + 12);
+        } else if (strncmp(argv[i], "--sparsity=", 11) == 0) {
+            sparsity = atof(argv[i] + 11);
+        } else if (strncmp(argv[i], "--zipf=", 7) == 0) {
+            zipf_s = atof(argv[i] + 7);
+        } else if (strncmp(argv[i], "--episode-length=", 17) == 0) {
+            episode_limit = atoi(argv[i] + 17);
+        } else {
+            fprintf(stderr, "Invalid option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (env_type == FROZENLAKE) {
+        num_states = lake_size * lake_size;
+        num_actions = 4;
+        episode_limit = lake_size == 4 ? QENV_FROZENLAKE_LIMIT_4X4 : QENV_FROZENLAKE_LIMIT_8X8;
+    } else if (env_type == TAXI) {
+        num_states = QENV_TAXI_STATES;
+        num_actions = QENV_TAXI_ACTIONS;
+        episode_limit = QENV_TAXI_LIMIT;
+    }
+    if (total_samples < 1 || num_threads < 1 || num_threads > MAX_THREADS || num_states < 1 || num_actions < 1 ||
+        branching < 1 || episode_limit < 1 || sparsity < 0 || sparsity > 1 || zipf_s < 0) {
+        fprintf(stderr, "Invalid arguments\n");
+        return EXIT_FAILURE;
+    }
+    if (env_type == RANDOM_MDP && build_random_mdp() != 0)
+        return 1;
+
+    out_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        perror("Error opening the output file");
+        return 1;
+    }
+    if (format_type == BINARY) {
+        QExperienceHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, QEXP_MAGIC, sizeof(header.magic));
+        header.version = QEXP_VERSION;
+        header.header_size = sizeof(QExperienceHeader);
+        header.record_size = sizeof(QExperience);
+        header.num_states = (uint32_t)num_states;
+        header.num_actions = (uint32_t)num_actions;
+        header.flags = log_next_action ? QEXP_HAS_NEXT_ACTION : 0;
+        header.num_samples = (uint64_t)total_samples;
+        if (write_all(out_fd, (const char*)&header, sizeof(header)) != 0) {
+            perror("Error writing output");
+            return 1;
+        }
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    num_blocks = (total_samples + BLOCK_SAMPLES - 1) / BLOCK_SAMPLES;
+    pthread_t threads[MAX_THREADS];
+    for (int t = 0; t < num_threads; t++)
+        pthread_create(&threads[t], NULL, generator_thread, NULL);
+    for (int t = 0; t < num_threads; t++)
+        pthread_join(threads[t], NULL);
+    off_t bytes = lseek(out_fd, 0, SEEK_CUR);
+    if (close(out_fd) != 0) {
+        perror("Error closing the output file");
+        return 1;
+    }
+    if (write_failed)
+        return 1;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("Wrote %ld samples (%d states, %d actions) to %s: %.1f MB in %f seconds (%.1f MB/s)\n", total_samples,
+           num_states, num_actions, output_path, bytes / 1e6, seconds, seconds > 0 ? bytes / 1e6 / seconds : 0.0);
+    printf("Train with: threaded_Baseline %s %d %d %ld <sampling> <algorithm>\n", output_path, num_states, num_actions, total_samples);
+
+    free(mdp_next);
+    free(mdp_reward);
+    free(zipf_cdf);
+    return 0;
+}
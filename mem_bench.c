@@ -0,0 +1,382 @@
+// Memory microbenchmarks calibrated to the Q-learning update kernel
+//
+// 1. Streaming read bandwidth over a plain double array and over an
+//    Experience array laid out like threaded_Baseline's dataset.
+// 2. Dependent random-access latency (pointer chasing, one cache line per
+//    hop) for working sets from L1-sized to DRAM-sized.
+// 3. The update kernel itself (qlearn_kernel.h, shared with the trainer) for
+//    Q-tables of the same sizes, in the SEQUENTIAL, RANDOM and STRIDE
+//    sampling orders of threaded_Baseline.
+//
+// The report puts each kernel rate next to the bounds the first two give:
+// compute (the kernel on an L1-resident table and dataset), bandwidth (bytes
+// the update has to move beyond the last-level cache divided by streaming
+// bandwidth) and serial latency (cache misses per update at the measured
+// latency, with no overlap). The measured rate per thread over the serial-
+// latency rate is the memory-level parallelism each core actually extracts;
+// the M upd/s column is the total over all threads. A working set counts as
+// DRAM-resident once its chase latency passes half that of the largest size,
+// so --max-mb has to go well past the last-level cache.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "qlearn_kernel.h"
+
+#define NUM_ACTIONS 16
+#define ALPHA 0.1
+#define GAMMA 0.95
+#define NUM_STRIDE 4
+#define CACHE_LINE 64
+#define NUM_THREADS 16
+#define DEFAULT_SAMPLES (4 << 20)     // 96 MiB of Experience records
+#define DEFAULT_MAX_MB 256            // Largest Q-table / pointer-chase working set
+#define MIN_TABLE_BYTES (16 << 10)
+#define STREAM_BYTES (256u << 20)
+#define COMPUTE_SAMPLES 4096          // Dataset for the compute bound: stays in L1/L2
+#define MIN_SECONDS 0.25              // Repeat each measurement for at least this long
+
+typedef struct {
+    int state;
+    int action;
+    double reward;
+    int next_state;
+    int next_action;
+} Experience;
+
+typedef enum {
+    SEQUENTIAL = 0,
+    RANDOM,
+    STRIDE
+} sampling;
+
+const char* sampling_names[] = { "SEQUENTIAL", "RANDOM", "STRIDE" };
+
+typedef struct {
+    const double* array;
+    size_t count;
+    const Experience* dataset;
+    long num_samples;
+    double sum;
+} StreamData;
+
+typedef struct {
+    Experience* dataset;
+    long num_samples;
+    double (*q_table)[NUM_ACTIONS];
+    sampling mode;
+    long updates;
+    double seconds;   // Timed window, after the warm-up pass
+} KernelData;
+
+int num_actions = NUM_ACTIONS;
+int num_threads = 1;
+char* volatile chase_sink;  // Keeps the pointer chase from being optimised away
+
+#define LCG_A 1664525
+#define LCG_C 1013904223
+
+unsigned int custom_rand(unsigned int *seed) {
+    *seed = (*seed * LCG_A + LCG_C);
+    return *seed;
+}
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// update_q_table of threaded_Baseline.c: the same row kernel on a dense table
+void update_q_table(Experience experience, double (*q_table)[NUM_ACTIONS]) {
+    qkernel_update_row(q_table[experience.state], experience.action, experience.reward, q_table[experience.next_state],
+                       num_actions, ALPHA, GAMMA);
+}
+
+// One pass in the order of the matching update_*_thread
+long kernel_pass(KernelData* k, unsigned int* rand_seed) {
+    long n = k->num_samples;
+    if (k->mode == SEQUENTIAL) {
+        for (long i = 0; i < n; i++)
+            update_q_table(k->dataset[i], k->q_table);
+        return n;
+    }
+    if (k->mode == RANDOM) {
+        for (long i = 0; i < n; i++)
+            update_q_table(k->dataset[custom_rand(rand_seed) % n], k->q_table);
+        return n;
+    }
+    for (int stride_idx = 0; stride_idx < NUM_STRIDE; stride_idx++) {
+        for (long i = 0; i < n / NUM_STRIDE; i++)
+            update_q_table(k->dataset[stride_idx + i * NUM_STRIDE], k->q_table);
+    }
+    return n / NUM_STRIDE * NUM_STRIDE;
+}
+
+void* kernel_thread(void* arg) {
+    KernelData* k = (KernelData*)arg;
+    unsigned int rand_seed = 42;
+    kernel_pass(k, &rand_seed);  // Warm-up
+    k->updates = 0;
+    double start = now_seconds();
+    do {
+        k->updates += kernel_pass(k, &rand_seed);
+        k->seconds = now_seconds() - start;
+    } while (k->seconds < MIN_SECONDS);
+    return NULL;
+}
+
+// Independent accumulators so the adds never limit the read rate
+void* stream_thread(void* arg) {
+    StreamData* d = (StreamData*)arg;
+    double sum[8] = { 0 };
+    int64_t fields = 0;
+    if (d->array != NULL) {
+        for (size_t i = 0; i + 8 <= d->count; i += 8) {
+            for (int j = 0; j < 8; j++)
+                sum[j] += d->array[i + j];
+        }
+    } else {
+        for (long i = 0; i + 2 <= d->num_samples; i += 2) {
+            fields += d->dataset[i].state + d->dataset[i].action + d->dataset[i].next_state;
+            fields += d->dataset[i + 1].state + d->dataset[i + 1].action + d->dataset[i + 1].next_state;
+            sum[0] += d->dataset[i].reward;
+            sum[1] += d->dataset[i + 1].reward;
+        }
+    }
+    d->sum = fields;
+    for (int j = 0; j < 8; j++)
+        d->sum += sum[j];
+    return NULL;
+}
+
+// Read bandwidth in bytes/sec over num_threads slices of array or dataset
+double stream_bandwidth(const double* array, size_t count, const Experience* dataset, long num_samples) {
+    pthread_t threads[NUM_THREADS];
+    StreamData data[NUM_THREADS];
+    size_t bytes = array != NULL ? count * sizeof(double) : (size_t)num_samples * sizeof(Experience);
+    double best = 0.0;
+    volatile double sink = 0.0;
+    double start = now_seconds();
+    do {
+        double t0 = now_seconds();
+        for (int t = 0; t < num_threads; t++) {
+            data[t].array = array != NULL ? array + count / num_threads * t : NULL;
+            data[t].count = count / num_threads;
+            data[t].dataset = dataset != NULL ? dataset + num_samples / num_threads * t : NULL;
+            data[t].num_samples = num_samples / num_threads;
+            pthread_create(&threads[t], NULL, stream_thread, &data[t]);
+        }
+        for (int t = 0; t < num_threads; t++) {
+            pthread_join(threads[t], NULL);
+            sink += data[t].sum;
+        }
+        double rate = bytes / (now_seconds() - t0);
+        if (rate > best)
+            best = rate;
+    } while (now_seconds() - start < MIN_SECONDS);
+    (void)sink;
+    return best;
+}
+
+// Average ns per dependent load over a random cyclic chain of cache lines
+double chase_latency(size_t bytes) {
+    size_t lines = bytes / CACHE_LINE;
+    char* buffer = (char*)aligned_alloc(CACHE_LINE, lines * CACHE_LINE);
+    size_t* order = (size_t*)malloc(lines * sizeof(size_t));
+    if (buffer == NULL || order == NULL) {
+        perror("Error allocating memory for pointer chasing");
+        exit(EXIT_FAILURE);
+    }
+    // Sattolo's algorithm: one cycle through every line
+    unsigned int seed = 42;
+    for (size_t i = 0; i < lines; i++)
+        order[i] = i;
+    for (size_t i = lines - 1; i > 0; i--) {
+        size_t j = ((size_t)custom_rand(&seed) << 16 ^ custom_rand(&seed)) % i;
+        size_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (size_t i = 0; i < lines; i++)
+        *(char**)(buffer + order[i] * CACHE_LINE) = buffer + order[(i + 1) % lines] * CACHE_LINE;
+    free(order);
+
+    char* p = buffer;
+    for (size_t i = 0; i < lines; i++)  // Warm-up: one full lap
+        p = *(char**)p;
+    long hops = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        for (int i = 0; i < 1 << 20; i++)
+            p = *(char**)p;
+        hops += 1 << 20;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+    chase_sink = p;
+    free(buffer);
+    return elapsed / hops * 1e9;
+}
+
+// Updates/sec of the kernel over num_threads private tables of num_states rows
+double kernel_rate(Experience* dataset, long num_samples, int num_states, sampling mode) {
+    pthread_t threads[NUM_THREADS];
+    KernelData data[NUM_THREADS];
+    for (int t = 0; t < num_threads; t++) {
+        data[t].dataset = dataset + num_samples / num_threads * t;
+        data[t].num_samples = num_samples / num_threads;
+        data[t].q_table = calloc(num_states, sizeof(double[NUM_ACTIONS]));
+        data[t].mode = mode;
+        if (data[t].q_table == NULL) {
+            perror("Error allocating memory for the Q-table");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int t = 0; t < num_threads; t++)
+        pthread_create(&threads[t], NULL, kernel_thread, &data[t]);
+    double rate = 0.0;
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+        rate += data[t].updates / data[t].seconds;
+        free(data[t].q_table);
+    }
+    return rate;
+}
+
+void fill_dataset(Experience* dataset, long n, int num_states) {
+    unsigned int seed = 7;
+    for (long i = 0; i < n; i++) {
+        dataset[i].state = (int)(custom_rand(&seed) % num_states);
+        dataset[i].action = (int)(custom_rand(&seed) % num_actions);
+        dataset[i].reward = custom_rand(&seed) % 10 == 0 ? 1.0 : 0.0;
+        dataset[i].next_state = (int)(custom_rand(&seed) % num_states);
+        dataset[i].next_action = -1;
+    }
+}
+
+void print_size(size_t bytes) {
+    if (bytes >= (1u << 20))
+        printf("%5zu MiB", bytes >> 20);
+    else
+        printf("%5zu KiB", bytes >> 10);
+}
+
+int main(int argc, char* argv[]) {
+    long num_samples = DEFAULT_SAMPLES;
+    size_t max_bytes = (size_t)DEFAULT_MAX_MB << 20;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--threads=", 10) == 0) {
+            num_threads = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--samples=", 10) == 0) {
+            num_samples = atol(argv[i] + 10);
+        } else if (strncmp(argv[i], "--max-mb=", 9) == 0) {
+            max_bytes = (size_t)atol(argv[i] + 9) << 20;
+        } else {
+            fprintf(stderr, "Usage: %s [--threads=<N>] [--samples=<N>] [--max-mb=<MiB>]\n", argv[0]);
+            fprintf(stderr, "  --threads   threads for the stream and kernel runs, 1..%d (default 1)\n", NUM_THREADS);
+            fprintf(stderr, "  --samples   Experience records for the kernel runs (default %d)\n", DEFAULT_SAMPLES);
+            fprintf(stderr, "  --max-mb    largest Q-table and pointer-chase working set (default %d)\n", DEFAULT_MAX_MB);
+            return EXIT_FAILURE;
+        }
+    }
+    if (num_threads < 1 || num_threads > NUM_THREADS || num_samples < COMPUTE_SAMPLES || max_bytes < MIN_TABLE_BYTES) {
+        fprintf(stderr, "Invalid arguments\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t row_bytes = NUM_ACTIONS * sizeof(double);
+    printf("Threads: %d, samples: %ld (%zu MiB of Experience)\n", num_threads, num_samples,
+           (size_t)num_samples * sizeof(Experience) >> 20);
+
+    // 1. Streaming bandwidth
+    double* array = (double*)malloc(STREAM_BYTES);
+    Experience* dataset = (Experience*)malloc((size_t)num_samples * sizeof(Experience));
+    if (array == NULL || dataset == NULL) {
+        perror("Error allocating memory");
+        return 1;
+    }
+    for (size_t i = 0; i < STREAM_BYTES / sizeof(double); i++)
+        array[i] = (double)i;
+    fill_dataset(dataset, num_samples, 1);
+    double stream_bw = stream_bandwidth(array, STREAM_BYTES / sizeof(double), NULL, 0);
+    double experience_bw = stream_bandwidth(NULL, 0, dataset, num_samples);
+    free(array);
+    printf("\nStreaming read bandwidth: %.2f GB/s (double array), %.2f GB/s = %.1f M samples/s (Experience array)\n",
+           stream_bw / 1e9, experience_bw / 1e9, experience_bw / sizeof(Experience) / 1e6);
+
+    // 2. Random-access latency
+    int num_sizes = 0;
+    size_t sizes[32];
+    double latency[32];
+    printf("\nRandom-access latency (dependent loads, one %d-byte line per hop):\n", CACHE_LINE);
+    for (size_t bytes = MIN_TABLE_BYTES; bytes <= max_bytes && num_sizes < 32; bytes *= 4) {
+        sizes[num_sizes] = bytes;
+        latency[num_sizes] = chase_latency(bytes);
+        printf("  ");
+        print_size(bytes);
+        printf("  %7.2f ns\n", latency[num_sizes]);
+        num_sizes++;
+    }
+    // Largest working set that still hits in some cache level
+    size_t cached_bytes = 0;
+    for (int z = 0; z < num_sizes; z++) {
+        if (latency[z] <= latency[num_sizes - 1] / 2)
+            cached_bytes = sizes[z];
+    }
+    printf("  cache-resident up to ");
+    print_size(cached_bytes);
+    printf("\n");
+
+    // 3. The update kernel against its bounds
+    fill_dataset(dataset, COMPUTE_SAMPLES * num_threads, MIN_TABLE_BYTES / row_bytes);
+    double compute = kernel_rate(dataset, COMPUTE_SAMPLES * num_threads, MIN_TABLE_BYTES / row_bytes, SEQUENTIAL);
+    printf("\nUpdate kernel (%d actions), compute bound %.1f M updates/s (L1-resident table and data)\n", NUM_ACTIONS, compute / 1e6);
+    printf("  table      sampling      M upd/s  bw bound  %% of bound  limited by   MLP\n");
+    for (int z = 0; z < num_sizes; z++) {
+        int num_states = (int)(sizes[z] / row_bytes);
+        fill_dataset(dataset, num_samples, num_states);
+        int table_misses = sizes[z] * num_threads > cached_bytes;
+        int dataset_misses = (size_t)num_samples * sizeof(Experience) > cached_bytes;
+        for (int mode = SEQUENTIAL; mode <= STRIDE; mode++) {
+            double rate = kernel_rate(dataset, num_samples, num_states, (sampling)mode);
+
+            // DRAM bytes per update: the record (a whole line unless streamed in
+            // order), then the next_state row and the written line with its writeback
+            double bytes = 0.0;
+            if (dataset_misses)
+                bytes += mode == SEQUENTIAL ? sizeof(Experience) : CACHE_LINE;
+            if (table_misses)
+                bytes += row_bytes + 2 * CACHE_LINE;
+            double bw_bound = bytes > 0 ? stream_bw / bytes : 0.0;
+            double bound = bw_bound > 0 && bw_bound < compute ? bw_bound : compute;
+
+            // Serial-latency rate: misses the prefetchers cannot hide, one at a time.
+            // rate sums all threads, so MLP takes one core's share of it.
+            double misses = (dataset_misses && mode != SEQUENTIAL ? 1 : 0) + (table_misses ? 2 : 0);
+            double mlp = misses > 0 ? rate / num_threads * misses * latency[z] * 1e-9 : 0.0;
+
+            printf("  ");
+            print_size(sizes[z]);
+            printf("  %-11s %9.1f  ", sampling_names[mode], rate / 1e6);
+            if (bw_bound > 0)
+                printf("%8.1f", bw_bound / 1e6);
+            else
+                printf("%8s", "-");
+            printf("  %9.0f%%  %-10s", 100.0 * rate / bound, bound == compute ? "compute" : "bandwidth");
+            if (misses > 0)
+                printf("  %4.1f\n", mlp);
+            else
+                printf("     -\n");
+        }
+    }
+    printf("\nbw bound: streaming bandwidth / DRAM bytes per update; MLP: misses in flight per core implied by the\n");
+    printf("per-thread share of the measured rate at the measured latency (1.0 = fully serial, near the latency bound)\n");
+
+    free(dataset);
+    return 0;
+}
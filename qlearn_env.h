@@ -0,0 +1,136 @@
+// Built-in environments and the random streams that drive them, shared by
+// gen_experiences (which rolls them out to make datasets) and
+// threaded_Baseline --evaluate (which rolls policies out in them), so both
+// always see the same dynamics
+//
+// Rewards are in hundredths so the generator's text output needs no
+// floating-point formatting; every reward is an exact multiple of 0.01 that
+// callers working in doubles divide by 100.
+
+#ifndef QLEARN_ENV_H
+#define QLEARN_ENV_H
+
+#include <stdint.h>
+
+#define QENV_FROZENLAKE_LIMIT_4X4 100  // Gym's episode time limits
+#define QENV_FROZENLAKE_LIMIT_8X8 200
+#define QENV_TAXI_LIMIT 200
+#define QENV_TAXI_STATES 500
+#define QENV_TAXI_ACTIONS 6
+
+// splitmix64: seeds an independent xorshift64* stream per block or episode
+static inline uint64_t qenv_splitmix64(uint64_t* x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// xorshift64*
+static inline uint64_t qenv_next_rand(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static inline int qenv_rand_below(uint64_t* state, int n) {
+    return (int)(((qenv_next_rand(state) >> 32) * (uint64_t)n) >> 32);
+}
+
+static inline double qenv_rand_unit(uint64_t* state) {
+    return (qenv_next_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// FrozenLake: start at state 0, reward 1 at the goal, holes and the goal end
+// the episode. Actions: 0 left, 1 down, 2 right, 3 up.
+static const char* const qenv_frozenlake_4x4[] = { "SFFF", "FHFH", "FFFH", "HFFG" };
+static const char* const qenv_frozenlake_8x8[] = { "SFFFFFFF", "FFFFFFFF", "FFFHFFFF", "FFFFFHFF",
+                                                   "FFFHFFFF", "FHHFFFHF", "FHFFHFHF", "FFFHFFFG" };
+
+// size is 4 or 8; returns 1 when next_state is terminal
+static inline int qenv_frozenlake_step(uint64_t* rng, int size, int slippery, int state, int action, int* next_state,
+                                       int* reward_centi) {
+    const char* const* lake = size == 8 ? qenv_frozenlake_8x8 : qenv_frozenlake_4x4;
+    if (slippery)
+        action = (action + 3 + qenv_rand_below(rng, 3)) % 4;  // a-1, a, a+1 with probability 1/3 each
+    int row = state / size, col = state % size;
+    if (action == 0 && col > 0)
+        col--;
+    else if (action == 1 && row < size - 1)
+        row++;
+    else if (action == 2 && col < size - 1)
+        col++;
+    else if (action == 3 && row > 0)
+        row--;
+    *next_state = row * size + col;
+    char tile = lake[row][col];
+    *reward_centi = tile == 'G' ? 100 : 0;
+    return tile == 'G' || tile == 'H';
+}
+
+// Taxi-v3 walls: a ':' to the east of column c in row r lets the taxi pass
+static const char* const qenv_taxi_map[] = { "+---------+", "|R: | : :G|", "| : | : : |", "| : : : : |",
+                                             "| | : | : |", "|Y| : |B: |", "+---------+" };
+static const int qenv_taxi_locs[4][2] = { { 0, 0 }, { 0, 4 }, { 4, 0 }, { 4, 3 } };
+
+static inline int qenv_taxi_encode(int row, int col, int passenger, int destination) {
+    return ((row * 5 + col) * 5 + passenger) * 4 + destination;
+}
+
+// Random taxi square, passenger at a pickup point, a different destination
+static inline int qenv_taxi_reset(uint64_t* rng) {
+    int passenger = qenv_rand_below(rng, 4);
+    int destination = qenv_rand_below(rng, 3);
+    if (destination >= passenger)
+        destination++;
+    // Drawn in separate statements: the order of draws in one expression is unspecified
+    int col = qenv_rand_below(rng, 5);
+    int row = qenv_rand_below(rng, 5);
+    return qenv_taxi_encode(row, col, passenger, destination);
+}
+
+// Actions: 0 south, 1 north, 2 east, 3 west, 4 pickup, 5 dropoff. Returns 1
+// when the passenger is dropped at the destination.
+static inline int qenv_taxi_step(int state, int action, int* next_state, int* reward_centi) {
+    int destination = state % 4;
+    int passenger = state / 4 % 5;
+    int col = state / 20 % 5;
+    int row = state / 100;
+    int done = 0;
+    *reward_centi = -100;
+
+    if (action == 0 && row < 4) {
+        row++;
+    } else if (action == 1 && row > 0) {
+        row--;
+    } else if (action == 2 && qenv_taxi_map[row + 1][2 * col + 2] == ':') {
+        col++;
+    } else if (action == 3 && qenv_taxi_map[row + 1][2 * col] == ':') {
+        col--;
+    } else if (action == 4) {
+        if (passenger < 4 && row == qenv_taxi_locs[passenger][0] && col == qenv_taxi_locs[passenger][1])
+            passenger = 4;
+        else
+            *reward_centi = -1000;
+    } else if (action == 5) {
+        int at = -1;
+        for (int l = 0; l < 4; l++) {
+            if (row == qenv_taxi_locs[l][0] && col == qenv_taxi_locs[l][1])
+                at = l;
+        }
+        if (passenger == 4 && at == destination) {
+            passenger = destination;
+            done = 1;
+            *reward_centi = 2000;
+        } else if (passenger == 4 && at >= 0) {
+            passenger = at;
+        } else {
+            *reward_centi = -1000;
+        }
+    }
+    *next_state = qenv_taxi_encode(row, col, passenger, destination);
+    return done;
+}
+
+#endif
@@ -0,0 +1,337 @@
+// Binary Q-table checkpoint format written by threaded_Baseline --checkpoint=<path>
+//
+// A 64-byte header followed by num_tables tables of num_states x num_actions
+// doubles (host byte order, row-major: Q(s, a) is element s * num_actions + a).
+// The payload starts 64 bytes in, so a consumer can mmap the file and index
+// the tables in place with qtable_at().
+//
+// Table order: for each configuration, its num_threads per-thread tables,
+// then (with QTABLE_HAS_MERGED) the mean of those tables.
+
+#ifndef QLEARN_FORMATS_H
+#define QLEARN_FORMATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#define QTABLE_MAGIC "QTABLE\r\n"  // 8 bytes, no terminator; \r\n catches text-mode mangling
+#define QTABLE_VERSION 1
+
+#define QTABLE_HAS_MERGED 0x1  // Each configuration ends with a merged table
+
+typedef struct {
+    char magic[8];          // QTABLE_MAGIC
+    uint32_t version;       // QTABLE_VERSION
+    uint32_t header_size;   // Byte offset of the first table
+    uint32_t value_size;    // sizeof(double)
+    uint32_t num_states;
+    uint32_t num_actions;
+    uint32_t num_threads;   // Per-thread tables per configuration
+    uint32_t num_configs;   // SWEEP configurations, 1 otherwise
+    uint32_t num_tables;    // Tables in the payload
+    uint32_t flags;         // QTABLE_HAS_MERGED
+    uint32_t reserved[5];
+} QTableHeader;
+
+_Static_assert(sizeof(QTableHeader) == 64, "QTableHeader must stay 64 bytes");
+
+static inline double* qtable_data(const QTableHeader* header) {
+    return (double*)((char*)header + header->header_size);
+}
+
+static inline double qtable_at(const QTableHeader* header, int table, int state, int action) {
+    size_t cells = (size_t)header->num_states * header->num_actions;
+    return qtable_data(header)[table * cells + (size_t)state * header->num_actions + action];
+}
+
+// Training state written by threaded_Baseline --state-file=<path> at episode
+// boundaries and read back by --resume. A 128-byte header, then num_threads
+// records of record_size bytes: a QStateThread followed by table_doubles
+// doubles of the thread's table (rows of NUM_ACTIONS, or NUM_ACTIONS *
+// config_stride for SWEEP) and prev_doubles doubles of its early-stopping
+// reference table.
+#define QSTATE_MAGIC "QSTATE\r\n"
+#define QSTATE_VERSION 1
+
+typedef struct {
+    char magic[8];              // QSTATE_MAGIC
+    uint32_t version;           // QSTATE_VERSION
+    uint32_t header_size;       // Byte offset of the first thread record
+    uint32_t record_size;
+    uint32_t num_states;
+    uint32_t num_actions;
+    uint32_t num_threads;
+    uint32_t num_samples;
+    uint32_t sampling;          // Enum values of the run that wrote the file
+    uint32_t algorithm;
+    uint32_t update;
+    uint32_t engine;
+    uint32_t config_stride;
+    int32_t episode;            // Last completed episode
+    int32_t converged_streak;   // Global early-stopping streak
+    uint64_t table_doubles;
+    uint64_t prev_doubles;
+    double last_delta_max;
+    double last_delta_mean;
+    uint32_t reserved[8];
+} QStateHeader;
+
+typedef struct {
+    uint32_t seed;              // SARSA exploration RNG
+    uint32_t rand_seed;         // RANDOM sampling RNG
+    int32_t converged_streak;
+    int32_t converged_episode;
+} QStateThread;
+
+_Static_assert(sizeof(QStateHeader) == 128, "QStateHeader must stay 128 bytes");
+_Static_assert(sizeof(QStateThread) == 16, "QStateThread must stay 16 bytes");
+
+// Binary experience dataset written by gen_experiences --format=BINARY and
+// read by threaded_Baseline instead of the text format (told apart by the
+// magic). A 64-byte header followed by num_samples QExperience records.
+// As with unmarked text logs, an episode ends where a record does not start
+// at the previous record's next_state.
+#define QEXP_MAGIC "QEXPER\r\n"
+#define QEXP_VERSION 1
+
+#define QEXP_HAS_NEXT_ACTION 0x1  // next_action holds the logged a_{t+1}
+
+typedef struct {
+    int32_t state;
+    int32_t action;
+    double reward;
+    int32_t next_state;
+    int32_t next_action;        // -1 at episode ends or without QEXP_HAS_NEXT_ACTION
+} QExperience;
+
+typedef struct {
+    char magic[8];              // QEXP_MAGIC
+    uint32_t version;           // QEXP_VERSION
+    uint32_t header_size;       // Byte offset of the first record
+    uint32_t record_size;       // sizeof(QExperience)
+    uint32_t num_states;
+    uint32_t num_actions;
+    uint32_t flags;             // QEXP_HAS_NEXT_ACTION
+    uint64_t num_samples;
+    uint32_t reserved[6];
+} QExperienceHeader;
+
+_Static_assert(sizeof(QExperience) == 24, "QExperience must stay 24 bytes");
+_Static_assert(sizeof(QExperienceHeader) == 64, "QExperienceHeader must stay 64 bytes");
+
+// Live progress page published by threaded_Baseline --stats=<path> and read
+// by qstat. A 128-byte header, then one 64-byte QStatsThread per worker (one
+// cache line each, so workers never share a line). The file is mmapped
+// shared; put it on a tmpfs such as /dev/shm to keep it off the disk.
+//
+// Each worker rewrites its own record once per episode and the run-wide
+// fields are written by one thread per episode, both under a sequence
+// counter: odd while a write is in progress. Readers copy through
+// qstats_read_thread() / qstats_read_run(), which retry torn copies. The
+// magic is written last, once the header is complete.
+#define QSTATS_MAGIC "QSTATS\r\n"
+#define QSTATS_VERSION 1
+
+#define QSTATS_HAS_DELTA 0x1  // --tol run: max |dQ| fields are maintained
+
+enum { QSTATS_RUNNING = 0, QSTATS_DONE };
+
+typedef struct {
+    char magic[8];              // QSTATS_MAGIC
+    uint32_t version;           // QSTATS_VERSION
+    uint32_t header_size;       // Byte offset of the first thread record
+    uint32_t record_size;
+    uint32_t num_threads;
+    uint32_t num_episodes;      // Episodes each worker will run at most
+    int32_t pid;
+    uint64_t start_ns;          // CLOCK_MONOTONIC when training started
+    uint64_t num_samples;
+    _Atomic uint32_t status;    // QSTATS_RUNNING, then QSTATS_DONE
+    uint32_t flags;             // QSTATS_HAS_DELTA
+    _Atomic uint64_t seq;       // Sequence counter for the fields below
+    int64_t episodes_run;       // Episodes completed by every thread (--tol)
+    double last_delta_max;
+    double last_delta_mean;
+    uint32_t reserved[10];
+} QStatsHeader;
+
+typedef struct {
+    _Atomic uint64_t seq;       // Sequence counter for the rest of the record
+    int64_t episode;            // Episodes completed
+    int64_t updates;
+    int64_t samples_per_episode;
+    double episode_seconds;     // Latency of the last episode
+    double delta_max;           // max |dQ| over the last episode (QSTATS_HAS_DELTA)
+    uint64_t updated_ns;        // CLOCK_MONOTONIC of the last write
+    uint32_t status;            // QSTATS_RUNNING, then QSTATS_DONE
+    uint32_t reserved;
+} QStatsThread;
+
+_Static_assert(sizeof(QStatsHeader) == 128, "QStatsHeader must stay 128 bytes");
+_Static_assert(sizeof(QStatsThread) == 64, "QStatsThread must stay 64 bytes");
+
+static inline QStatsThread* qstats_thread(const QStatsHeader* header, int thread) {
+    return (QStatsThread*)((char*)header + header->header_size + (size_t)thread * header->record_size);
+}
+
+// Consistent copy of a worker's record
+static inline void qstats_read_thread(const QStatsHeader* header, int thread, QStatsThread* out) {
+    QStatsThread* record = qstats_thread(header, thread);
+    uint64_t before, after;
+    do {
+        before = atomic_load_explicit(&record->seq, memory_order_acquire);
+        memcpy((char*)out + sizeof(out->seq), (char*)record + sizeof(record->seq), sizeof(*out) - sizeof(out->seq));
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&record->seq, memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+    atomic_init(&out->seq, after);
+}
+
+// Consistent copy of the run-wide fields
+static inline void qstats_read_run(const QStatsHeader* header, int64_t* episodes_run, double* delta_max, double* delta_mean) {
+    uint64_t before, after;
+    do {
+        before = atomic_load_explicit(&header->seq, memory_order_acquire);
+        *episodes_run = header->episodes_run;
+        *delta_max = header->last_delta_max;
+        *delta_mean = header->last_delta_mean;
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&header->seq, memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+}
+
+// Greedy policy written by threaded_Baseline --policy=<path>: a 64-byte
+// header, then num_policies arrays (one per SWEEP configuration) of
+// num_states actions, action_size bytes each (uint8_t when num_actions <=
+// 256, else uint16_t). Arrays start policy_stride bytes apart, a multiple of
+// 64 with at least 4 bytes of padding after the last action, so 4-byte
+// gathers never leave the array. Lookups: qlearn_policy.h.
+#define QPOLICY_MAGIC "QPOLCY\r\n"
+#define QPOLICY_VERSION 1
+
+typedef struct {
+    char magic[8];              // QPOLICY_MAGIC
+    uint32_t version;           // QPOLICY_VERSION
+    uint32_t header_size;       // Byte offset of the first array
+    uint32_t num_states;
+    uint32_t num_actions;
+    uint32_t action_size;       // 1 or 2
+    uint32_t num_policies;
+    uint64_t policy_stride;
+    uint32_t reserved[6];
+} QPolicyHeader;
+
+_Static_assert(sizeof(QPolicyHeader) == 64, "QPolicyHeader must stay 64 bytes");
+
+static inline uint8_t* qpolicy_actions(const QPolicyHeader* header, int policy) {
+    return (uint8_t*)header + header->header_size + policy * header->policy_stride;
+}
+
+// Q-tables published while training by threaded_Baseline --publish=<path>:
+// every --publish-every episodes, and once more at the end, the mean of the
+// per-thread tables (one per SWEEP configuration) is written into a shared
+// mapping. A 64-byte header, then two slots of slot_size bytes: a 64-byte
+// QPublishSlot followed by num_tables tables of num_states x num_actions
+// doubles (row-major, as in the QTABLE payload).
+//
+// Publication p (counting from 1) goes into slot p % 2, so the writer only
+// ever rewrites the slot readers are not directed to. Each slot has its own
+// sequence counter, odd while it is being rewritten. Readers either copy the
+// latest tables with qpub_read_latest(), or use them in place between
+// qpub_latest() and a successful qpub_unchanged() check; only a reader that
+// takes longer than two publication intervals ever has to retry.
+#define QPUB_MAGIC "QTPUBL\r\n"
+#define QPUB_VERSION 1
+
+typedef struct {
+    char magic[8];              // QPUB_MAGIC
+    uint32_t version;           // QPUB_VERSION
+    uint32_t header_size;       // Byte offset of slot 0
+    uint32_t num_states;
+    uint32_t num_actions;
+    uint32_t num_tables;        // SWEEP configurations, 1 otherwise
+    int32_t pid;
+    uint64_t slot_size;
+    _Atomic uint64_t published; // Publications so far; the latest is in slot published % 2
+    _Atomic uint32_t status;    // QSTATS_RUNNING, then QSTATS_DONE after the final publication
+    uint32_t reserved[3];
+} QPublishHeader;
+
+typedef struct {
+    _Atomic uint64_t seq;       // Odd while the slot is being rewritten
+    uint64_t publication;       // Publication number held by the slot
+    int64_t episode;            // Last episode every thread had completed
+    uint64_t published_ns;      // CLOCK_MONOTONIC of the write
+    uint32_t num_threads;       // Tables averaged
+    uint32_t reserved[7];
+} QPublishSlot;
+
+_Static_assert(sizeof(QPublishHeader) == 64, "QPublishHeader must stay 64 bytes");
+_Static_assert(sizeof(QPublishSlot) == 64, "QPublishSlot must stay 64 bytes");
+
+static inline QPublishSlot* qpub_slot(const QPublishHeader* header, int slot) {
+    return (QPublishSlot*)((char*)header + header->header_size + slot * header->slot_size);
+}
+
+static inline const double* qpub_tables(const QPublishSlot* slot) {
+    return (const double*)(slot + 1);
+}
+
+// Slot holding the latest publication, and its sequence number for
+// qpub_unchanged(); NULL before the first publication
+static inline const QPublishSlot* qpub_latest(const QPublishHeader* header, uint64_t* seq) {
+    for (;;) {
+        uint64_t published = atomic_load_explicit(&header->published, memory_order_acquire);
+        if (published == 0)
+            return NULL;
+        const QPublishSlot* slot = qpub_slot(header, (int)(published % 2));
+        *seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if ((*seq & 1) == 0 && slot->publication == published)
+            return slot;
+    }
+}
+
+// Whether everything read from slot since qpub_latest() was consistent
+static inline int qpub_unchanged(const QPublishSlot* slot, uint64_t seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq;
+}
+
+// Copy the latest tables (num_tables x num_states x num_actions doubles) and
+// the slot's metadata; returns the publication number, 0 before the first
+static inline uint64_t qpub_read_latest(const QPublishHeader* header, double* tables, QPublishSlot* meta) {
+    size_t bytes = (size_t)header->num_tables * header->num_states * header->num_actions * sizeof(double);
+    for (;;) {
+        uint64_t seq;
+        const QPublishSlot* slot = qpub_latest(header, &seq);
+        if (slot == NULL)
+            return 0;
+        memcpy(tables, qpub_tables(slot), bytes);
+        memcpy((char*)meta + sizeof(meta->seq), (const char*)slot + sizeof(slot->seq), sizeof(*meta) - sizeof(meta->seq));
+        if (qpub_unchanged(slot, seq)) {
+            atomic_init(&meta->seq, seq);
+            return meta->publication;
+        }
+    }
+}
+
+// Text output: v in decimal at p, no terminator; returns the end. The sample
+// lines of gen_experiences and threaded_Baseline's table printing use it.
+static inline char* qformat_int(char* p, int v) {
+    char digits[12];
+    int len = 0;
+    unsigned int u = v < 0 ? 0u - (unsigned int)v : (unsigned int)v;
+    if (v < 0)
+        *p++ = '-';
+    do {
+        digits[len++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u > 0);
+    while (len > 0)
+        *p++ = digits[--len];
+    return p;
+}
+
+#endif
@@ -0,0 +1,186 @@
+// Sparse Q-table: an open-addressing hash map from state to its row of
+// action values, for state spaces far larger than the part the data touches
+//
+// Keys sit QHASH_BUCKET_KEYS to a 64-byte bucket and a probe walks whole
+// buckets, so a lookup usually reads one cache line of keys and then the
+// row. Slot i of bucket b owns row b * QHASH_BUCKET_KEYS + i of values, all
+// of a state's actions side by side. Keys fill a bucket from its first lane,
+// so an empty lane ends the probe. A state without a row reads as zeros,
+// like an untouched row of a dense table.
+//
+// The table never grows: qhash_init sizes it for max_rows at a load of at
+// most QHASH_MAX_LOAD. qhash_insert and qhash_find compare a whole bucket at
+// once (with AVX2, two 8-lane compares) and are for a table owned by one
+// thread, or shared but no longer written. qhash_insert_concurrent claims
+// lanes with a CAS so any number of threads can insert into one table.
+
+#ifndef QLEARN_HASH_H
+#define QLEARN_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#define QHASH_BUCKET_KEYS 16  // int32 keys per 64-byte bucket
+#define QHASH_MAX_LOAD 0.75
+#define QHASH_EMPTY (-1)      // States are never negative
+
+typedef struct {
+    _Atomic int32_t* keys;  // buckets * QHASH_BUCKET_KEYS, QHASH_EMPTY when free
+    double* values;         // row_size doubles per slot
+    double* zero_row;       // What qhash_find returns for a state without a row
+    size_t buckets;         // Power of two
+    int shift;              // 64 - log2(buckets)
+    int row_size;
+    atomic_long size;       // Rows in use
+} QHash;
+
+_Static_assert(QHASH_BUCKET_KEYS * sizeof(int32_t) == 64, "A bucket must fill one cache line");
+
+// 0 on success, -1 (with errno set) when out of memory
+static inline int qhash_init(QHash* table, size_t max_rows, int row_size) {
+    size_t slots = (size_t)(max_rows / QHASH_MAX_LOAD) + 1;
+    int bits = 1;
+    while (((size_t)1 << bits) * QHASH_BUCKET_KEYS < slots)
+        bits++;
+    table->buckets = (size_t)1 << bits;
+    table->shift = 64 - bits;
+    table->row_size = row_size;
+    atomic_init(&table->size, 0);
+    slots = table->buckets * QHASH_BUCKET_KEYS;
+    table->keys = (_Atomic int32_t*)aligned_alloc(64, slots * sizeof(int32_t));
+    // calloc leaves the pages of rows that are never used untouched
+    table->values = (double*)calloc(slots, row_size * sizeof(double));
+    table->zero_row = (double*)calloc(row_size, sizeof(double));
+    if (table->keys == NULL || table->values == NULL || table->zero_row == NULL) {
+        free((void*)table->keys);
+        free(table->values);
+        free(table->zero_row);
+        return -1;
+    }
+    memset((void*)table->keys, 0xFF, slots * sizeof(int32_t));  // All QHASH_EMPTY
+    return 0;
+}
+
+static inline void qhash_free(QHash* table) {
+    free((void*)table->keys);
+    free(table->values);
+    free(table->zero_row);
+    table->keys = NULL;
+    table->values = NULL;
+    table->zero_row = NULL;
+}
+
+static inline size_t qhash_slots(const QHash* table) {
+    return table->buckets * QHASH_BUCKET_KEYS;
+}
+
+// State owning a slot, or QHASH_EMPTY
+static inline int32_t qhash_key(const QHash* table, size_t slot) {
+    return atomic_load_explicit(&table->keys[slot], memory_order_acquire);
+}
+
+static inline double* qhash_row(const QHash* table, size_t slot) {
+    return table->values + slot * table->row_size;
+}
+
+static inline size_t qhash_bucket(const QHash* table, int32_t state) {
+    return (size_t)(((uint64_t)(uint32_t)state * 0x9E3779B97F4A7C15ull) >> table->shift);
+}
+
+// Masks of the lanes of a bucket holding state and of its empty lanes. A
+// bucket's keys are read as plain ints, so nothing may insert into the table
+// concurrently.
+static inline unsigned qhash_scan(const QHash* table, size_t bucket, int32_t state, unsigned* empty) {
+    const int32_t* keys = (const int32_t*)(table->keys + bucket * QHASH_BUCKET_KEYS);
+#ifdef __AVX2__
+    __m256i lo = _mm256_load_si256((const __m256i*)keys);
+    __m256i hi = _mm256_load_si256((const __m256i*)keys + 1);
+    __m256i key = _mm256_set1_epi32(state), vacant = _mm256_set1_epi32(QHASH_EMPTY);
+    *empty = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(lo, vacant))) |
+             (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(hi, vacant))) << 8;
+    return (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(lo, key))) |
+           (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(hi, key))) << 8;
+#else
+    // Lanes fill in order, so only the first match or empty lane matters
+    *empty = 0;
+    for (int lane = 0; lane < QHASH_BUCKET_KEYS; lane++) {
+        if (keys[lane] == state)
+            return 1u << lane;
+        if (keys[lane] == QHASH_EMPTY) {
+            *empty = 1u << lane;
+            return 0;
+        }
+    }
+    return 0;
+#endif
+}
+
+static inline const double* qhash_find(const QHash* table, int32_t state) {
+    size_t bucket = qhash_bucket(table, state);
+    for (size_t probe = 0; probe < table->buckets; probe++) {
+        unsigned empty;
+        unsigned found = qhash_scan(table, bucket, state, &empty);
+        if (found != 0)
+            return qhash_row(table, bucket * QHASH_BUCKET_KEYS + __builtin_ctz(found));
+        if (empty != 0)
+            return table->zero_row;
+        bucket = (bucket + 1) & (table->buckets - 1);
+    }
+    return table->zero_row;
+}
+
+// Row of state, created (zeroed) if missing. Only the owning thread may
+// insert; NULL only if more than max_rows states go in.
+static inline double* qhash_insert(QHash* table, int32_t state) {
+    size_t bucket = qhash_bucket(table, state);
+    for (size_t probe = 0; probe < table->buckets; probe++) {
+        unsigned empty;
+        unsigned found = qhash_scan(table, bucket, state, &empty);
+        if (found != 0)
+            return qhash_row(table, bucket * QHASH_BUCKET_KEYS + __builtin_ctz(found));
+        if (empty != 0) {
+            size_t slot = bucket * QHASH_BUCKET_KEYS + __builtin_ctz(empty);
+            atomic_store_explicit(&table->keys[slot], state, memory_order_release);
+            atomic_store_explicit(&table->size, atomic_load_explicit(&table->size, memory_order_relaxed) + 1,
+                                  memory_order_relaxed);
+            return qhash_row(table, slot);
+        }
+        bucket = (bucket + 1) & (table->buckets - 1);
+    }
+    return NULL;
+}
+
+// qhash_insert for a table shared between threads: a lane is claimed by
+// CAS-ing its key out of QHASH_EMPTY, and a thread that loses the race to
+// another inserting the same state gets that thread's row. Rows start at
+// zero, so a reader that sees the key also sees the zeroed row.
+static inline double* qhash_insert_concurrent(QHash* table, int32_t state) {
+    size_t bucket = qhash_bucket(table, state);
+    for (size_t probe = 0; probe < table->buckets; probe++) {
+        _Atomic int32_t* keys = table->keys + bucket * QHASH_BUCKET_KEYS;
+        for (int lane = 0; lane < QHASH_BUCKET_KEYS; lane++) {
+            int32_t key = atomic_load_explicit(&keys[lane], memory_order_acquire);
+            if (key == QHASH_EMPTY) {
+                if (atomic_compare_exchange_strong_explicit(&keys[lane], &key, state, memory_order_acq_rel,
+                                                            memory_order_acquire)) {
+                    atomic_fetch_add_explicit(&table->size, 1, memory_order_relaxed);
+                    return qhash_row(table, bucket * QHASH_BUCKET_KEYS + lane);
+                }
+                // key now holds the state that won the lane
+            }
+            if (key == state)
+                return qhash_row(table, bucket * QHASH_BUCKET_KEYS + lane);
+        }
+        bucket = (bucket + 1) & (table->buckets - 1);
+    }
+    return NULL;
+}
+
+#endif
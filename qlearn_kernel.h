@@ -0,0 +1,23 @@
+// The Q-learning TD update on one row, shared by threaded_Baseline's
+// update_q_row and mem_bench's kernel runs so the benchmark always times the
+// arithmetic the trainer does
+//
+// row is Q(s, .) and next_row Q(s', .) with next_count actions. The bootstrap
+// is max(0, max_a' Q(s', a')): a row that was never written reads as zeros.
+
+#ifndef QLEARN_KERNEL_H
+#define QLEARN_KERNEL_H
+
+static inline void qkernel_update_row(double* row, int action, double reward, const double* next_row, int next_count,
+                                      double alpha, double gamma) {
+    double max_next_q = 0;
+    for (int next_a = 0; next_a < next_count; next_a++) {
+        if (next_row[next_a] > max_next_q) {
+            max_next_q = next_row[next_a];
+        }
+    }
+
+    row[action] += alpha * (reward + gamma * max_next_q - row[action]);
+}
+
+#endif
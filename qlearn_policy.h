@@ -0,0 +1,84 @@
+// Greedy-policy extraction and batched lookups over the QPolicyHeader
+// format of qlearn_formats.h
+//
+// Built with AVX2 enabled (-mavx2 or -march=native) both loops run four or
+// eight states per step; otherwise the scalar loops give the same answers.
+
+#ifndef QLEARN_POLICY_H
+#define QLEARN_POLICY_H
+
+#include "qlearn_formats.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+static inline void qpolicy_store(void* actions, int action_size, int state, int action) {
+    if (action_size == 1)
+        ((uint8_t*)actions)[state] = (uint8_t)action;
+    else
+        ((uint16_t*)actions)[state] = (uint16_t)action;
+}
+
+// Greedy action of each state in [first_state, end_state) of a row-major
+// table (Q(s, a) at q[s * row_stride + a]) into actions[state]: the lowest
+// action among the maxima, as --print=GREEDY picks it. With AVX2 four states
+// go together, each action column gathered across their rows.
+static inline void qpolicy_extract(const double* q, size_t row_stride, int num_actions, int first_state, int end_state,
+                                   int action_size, void* actions) {
+    int state = first_state;
+#ifdef __AVX2__
+    __m256i rows = _mm256_set_epi64x(3 * (long long)row_stride, 2 * (long long)row_stride, (long long)row_stride, 0);
+    for (; state + 4 <= end_state; state += 4) {
+        const double* base = q + (size_t)state * row_stride;
+        __m256d best = _mm256_i64gather_pd(base, rows, 8);
+        __m256d best_action = _mm256_setzero_pd();
+        for (int action = 1; action < num_actions; action++) {
+            __m256d value = _mm256_i64gather_pd(base + action, rows, 8);
+            __m256d greater = _mm256_cmp_pd(value, best, _CMP_GT_OQ);
+            best = _mm256_blendv_pd(best, value, greater);
+            best_action = _mm256_blendv_pd(best_action, _mm256_set1_pd(action), greater);
+        }
+        int32_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, _mm256_cvtpd_epi32(best_action));
+        for (int i = 0; i < 4; i++)
+            qpolicy_store(actions, action_size, state + i, lanes[i]);
+    }
+#endif
+    for (; state < end_state; state++) {
+        const double* row = q + (size_t)state * row_stride;
+        int best = 0;
+        for (int action = 1; action < num_actions; action++) {
+            if (row[action] > row[best])
+                best = action;
+        }
+        qpolicy_store(actions, action_size, state, best);
+    }
+}
+
+// out[i] = action of states[i] under the given policy; states must lie in
+// [0, num_states). With AVX2 eight states go per gather: each lane loads the
+// four bytes at its entry and keeps the low action_size bytes, which the
+// padding after every array keeps in bounds.
+static inline void qpolicy_lookup(const QPolicyHeader* header, int policy, const int32_t* states, int n, int32_t* out) {
+    const uint8_t* actions = qpolicy_actions(header, policy);
+    int i = 0;
+#ifdef __AVX2__
+    __m256i mask = _mm256_set1_epi32(header->action_size == 1 ? 0xFF : 0xFFFF);
+    __m128i shift = _mm_cvtsi32_si128(header->action_size == 1 ? 0 : 1);
+    for (; i + 8 <= n; i += 8) {
+        __m256i offsets = _mm256_sll_epi32(_mm256_loadu_si256((const __m256i*)(states + i)), shift);
+        __m256i words = _mm256_i32gather_epi32((const int*)actions, offsets, 1);
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_and_si256(words, mask));
+    }
+#endif
+    if (header->action_size == 1) {
+        for (; i < n; i++)
+            out[i] = actions[states[i]];
+    } else {
+        for (; i < n; i++)
+            out[i] = ((const uint16_t*)actions)[states[i]];
+    }
+}
+
+#endif
@@ -0,0 +1,173 @@
+// Live progress of a running threaded_Baseline
+//
+// Attaches read-only to the page a trainer publishes with --stats=<path> and
+// prints run-wide and per-thread progress every --interval seconds until the
+// run finishes. Threads more than an episode behind the leader are flagged,
+// as are threads whose record has not moved for several of their own
+// episode times.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "qlearn_formats.h"
+
+#define DEFAULT_INTERVAL 1.0  // Seconds between reports
+#define STALL_EPISODES 4      // A record this many episode times old counts as stalled
+#define MAX_THREADS 1024
+
+uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Map the page once its header is complete; NULL on error
+QStatsHeader* attach(const char* path, size_t* bytes) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(QStatsHeader)) {
+        fprintf(stderr, "%s: not a stats page (too short)\n", path);
+        close(fd);
+        return NULL;
+    }
+    *bytes = st.st_size;
+    QStatsHeader* header = mmap(NULL, *bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+    int valid = memcmp(header->magic, QSTATS_MAGIC, sizeof(header->magic)) == 0;
+    atomic_thread_fence(memory_order_acquire);
+    if (!valid || header->version != QSTATS_VERSION || header->record_size != sizeof(QStatsThread) ||
+        header->num_threads < 1 || header->num_threads > MAX_THREADS ||
+        header->header_size + (size_t)header->num_threads * header->record_size > *bytes) {
+        fprintf(stderr, "%s: not a stats page written by this version of threaded_Baseline\n", path);
+        munmap(header, *bytes);
+        return NULL;
+    }
+    return header;
+}
+
+// One report; prev_updates/prev_ns carry the totals of the last one so the
+// rate covers the interval rather than the whole run
+void print_progress(const QStatsHeader* header, long long* prev_updates, uint64_t* prev_ns) {
+    static QStatsThread records[MAX_THREADS];
+    int n = header->num_threads;
+    uint64_t now = monotonic_ns();
+    long long updates = 0;
+    int64_t leader = 0;
+    int done = 0;
+    uint64_t last_write = header->start_ns;
+    for (int t = 0; t < n; t++) {
+        qstats_read_thread(header, t, &records[t]);
+        updates += records[t].updates;
+        if (records[t].episode > leader)
+            leader = records[t].episode;
+        done += records[t].status == QSTATS_DONE;
+        if (records[t].updated_ns > last_write)
+            last_write = records[t].updated_ns;
+    }
+
+    int finished = atomic_load(&header->status) == QSTATS_DONE;
+    double elapsed = ((finished ? last_write : now) - header->start_ns) / 1e9;
+    double interval = *prev_ns > 0 ? (now - *prev_ns) / 1e9 : elapsed;
+    double rate = interval > 0 ? (updates - *prev_updates) / interval : 0.0;
+    *prev_updates = updates;
+    *prev_ns = now;
+
+    printf("pid %d: %s, %.1f s, %lld updates, %.2f M updates/s, %d of %d threads done\n", header->pid,
+           finished ? "finished" : "running", elapsed, updates, rate / 1e6, done, n);
+    if (header->flags & QSTATS_HAS_DELTA) {
+        int64_t episodes_run;
+        double delta_max, delta_mean;
+        qstats_read_run(header, &episodes_run, &delta_max, &delta_mean);
+        printf("  all threads through episode %lld of %u: max |dQ| %g, mean |dQ| %g\n", (long long)episodes_run,
+               header->num_episodes, delta_max, delta_mean);
+    }
+    printf("  thread     episode     updates   M upd/s  episode ms%s  last seen\n",
+           header->flags & QSTATS_HAS_DELTA ? "     max |dQ|" : "");
+    for (int t = 0; t < n; t++) {
+        const QStatsThread* r = &records[t];
+        double age = now > r->updated_ns ? (now - r->updated_ns) / 1e9 : 0.0;
+        double thread_rate = r->episode_seconds > 0 ? r->samples_per_episode / r->episode_seconds : 0.0;
+        printf("  %6d  %5lld/%-5u  %10lld  %8.2f  %10.3f", t, (long long)r->episode, header->num_episodes,
+               (long long)r->updates, thread_rate / 1e6, r->episode_seconds * 1e3);
+        if (header->flags & QSTATS_HAS_DELTA)
+            printf("  %11.4g", r->delta_max);
+        printf("  %7.1f s ago", age);
+        if (r->status == QSTATS_DONE)
+            printf("  done");
+        else if (r->episode_seconds > 0 && age > STALL_EPISODES * r->episode_seconds + 1.0)
+            printf("  STALLED");
+        else if (r->episode + 1 < leader)
+            printf("  behind by %lld episodes", (long long)(leader - r->episode));
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <stats_path> [options]\n", argv[0]);
+        fprintf(stderr, "Options:\n");
+        fprintf(stderr, "  --interval=<seconds>   time between reports (default %g)\n", DEFAULT_INTERVAL);
+        fprintf(stderr, "  --once                 print one report and exit\n");
+        fprintf(stderr, "Exit status: 0 once the run finished, 1 on errors, 3 if the trainer died mid-run\n");
+        return EXIT_FAILURE;
+    }
+    char* path = argv[1];
+    double interval = DEFAULT_INTERVAL;
+    int once = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--interval=", 11) == 0) {
+            interval = atof(argv[i] + 11);
+            if (interval <= 0) {
+                fprintf(stderr, "Invalid interval: %s\n", argv[i] + 11);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--once") == 0) {
+            once = 1;
+        } else {
+            fprintf(stderr, "Invalid option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t bytes;
+    QStatsHeader* header = attach(path, &bytes);
+    if (header == NULL)
+        return 1;
+
+    long long prev_updates = 0;
+    uint64_t prev_ns = 0;
+    int status = 0;
+    for (;;) {
+        print_progress(header, &prev_updates, &prev_ns);
+        if (once || atomic_load(&header->status) == QSTATS_DONE)
+            break;
+        if (kill(header->pid, 0) != 0 && errno == ESRCH) {
+            fprintf(stderr, "Trainer %d exited without finishing the run\n", header->pid);
+            status = 3;
+            break;
+        }
+        struct timespec pause = { (time_t)interval, (long)((interval - (time_t)interval) * 1e9) };
+        nanosleep(&pause, NULL);
+        printf("\n");
+    }
+    munmap(header, bytes);
+    return status;
+}
@@ -4,9 +4,27 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
 #include <inttypes.h>
+#include <math.h>
 #include <time.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "qlearn_formats.h"
+#include "qlearn_policy.h"
+#include "qlearn_hash.h"
+#include "qlearn_kernel.h"
+#include "qlearn_env.h"
 
 #define NUM_STATES 500
 #define NUM_ACTIONS 16
@@ -17,39 +35,343 @@
 #define BATCH_CAPACITY 5000000
 #define NUM_STRIDE 4  // Define a stride value
 #define EPSILON 0.1 // For epsilon-greedy policy
+#define CONVERGENCE_PATIENCE 10  // Consecutive episodes below the tolerance before stopping
+#define VALUE_ITERATION_TOL 1e-9  // Default stopping residual for the model-based engine
+#define LAMBDA 0.9            // Trace decay for QLAMBDA / SARSALAMBDA
+#define TRACE_CAPACITY 64     // Maximum active eligibility traces per thread
+#define TRACE_CUTOFF 1e-3     // Traces below this are dropped
+#define SAVE_EVERY 100  // Episodes between training state snapshots
+#define PUBLISH_EVERY 10  // Episodes between --publish table publications
+#define EVAL_HORIZON 100  // Step limit per --evaluate episode in the empirical model
+#define EVAL_SEED 42
+#define FIXED_COEFF_BITS 16  // --fixed: ALPHA and GAMMA as integer multipliers scaled by 2^16
+#define LATENCY_BUCKETS 32  // Episode latency histogram: bucket 0 is [0, 2) us, bucket b is [2^b, 2^(b+1)) us
+#define NUM_COUNTERS 6  // Hardware counters opened per thread by --perf
+#define TRACE_RING_EVENTS (1 << 14)  // Spans kept per thread by --trace (power of two); older ones are overwritten
+#define OUTPUT_BUFFER_SIZE (1 << 16)  // Text dump buffer, flushed with one fwrite
+#define PSWEEP_QUEUE_CAPACITY (1 << 20)  // Pending (s,a) backups per prioritized-sweeping shard
+#define MAX_SWEEP_CONFIGS 64  // (alpha, gamma, epsilon) settings trained together by the SWEEP engine
+#define SWEEP_LANES 4         // Configurations updated together per register block
 
 // Define a macro for the number of threads
 #define NUM_THREADS 16
 
+// Manifest (multi-job) mode
+#define MAX_JOBS 4096
+#define MAX_JOB_ARGS 48
+#define SMALL_JOB_SAMPLES 200000  // Jobs with fewer samples run single-threaded
+
 typedef struct {
     int state;
     int action;
     double reward;
     int next_state;
+    int next_action;  // Logged a_{t+1}, or -1 when the data has only 4 fields
 } Experience;
 
+// Binary datasets are read straight into Experience records
+_Static_assert(sizeof(Experience) == sizeof(QExperience), "Experience must match the binary record layout");
+
+// One complete ("ph": "X") trace event, times in ns since trace_origin
+typedef struct {
+    uint64_t start;
+    uint64_t duration;
+    int name;   // trace_name
+    int arg;    // Episode number, or -1
+} TraceEvent;
+
+// Per-thread ring of trace events. Only the owning thread writes it and it is
+// read after that thread is joined, so recording takes no locks or atomics.
+typedef struct {
+    TraceEvent* events;   // NULL when --trace is off
+    uint64_t written;     // Events recorded; the ring holds the last TRACE_RING_EVENTS
+} TraceRing;
+
 typedef struct {
     Experience* dataset;
+    int thread_id;
     int start_index;
     int end_index;
+    int traj_start;   // Trajectories [traj_start, traj_end) for BACKWARD sampling
+    int traj_end;
     double (*q_table)[NUM_ACTIONS];  // Pass Q-table as a pointer to the array
+    double* sweep_table;  // SWEEP engine: [state][action][config_stride], configs in adjacent lanes
+    QHash* hash_table;    // --table=HASH: this thread's sparse table instead of q_table
+    double* ragged_table; // --actions: this thread's table as rows of action_offsets, instead of q_table
+    void* fixed_table;    // --fixed: int16/int32 [state][num_actions]; q_table only trains with --fixed-check
+    long saturations;     // Fixed-point stores that had to saturate
+    unsigned int check_seed;  // RNG of the --fixed-check double table
+
+    // Per-episode |dQ|, measured against the table as it was at the previous episode boundary
+    double (*prev_q_table)[NUM_ACTIONS];
+    double delta_max;
+    double delta_sum;
+    long delta_count;
+    int converged_streak;
+    int converged_episode;  // -1 until the thread stays below the tolerance for the full patience
+
+    // Sparse eligibility traces: only (s,a) slots with a live trace are stored
+    int trace_len;
+    int trace_slots[TRACE_CAPACITY];
+    double trace_values[TRACE_CAPACITY];
+    int last_index;   // Sample processed last, to detect jumps out of a trajectory
+    int trace_end;    // End of the trajectory the traces belong to
+
+    // Mini-batch scratch space (only allocated for the BATCH_* update modes)
+    int batch_len;
+    int* batch_indices;   // Dataset indices gathered for the current batch
+    int* batch_slots;     // Flattened (s,a) slot of each gathered sample
+    double* batch_td;     // TD error of each gathered sample
+    double* batch_delta;  // Accumulated TD error per (s,a) slot
+    int* batch_count;     // Number of samples merged into each (s,a) slot
+    int* batch_touched;   // Slots written by the current batch
+
+    // RNG state as of the last episode boundary, and the first episode to run
+    // (non-zero after --resume)
+    unsigned int seed;
+    unsigned int rand_seed;
+    int start_episode;
+
+    // Timing (--report), taken at episode boundaries only
+    long pass_samples;    // Samples processed per episode
+    long updates;
+    double cpu_seconds;
+    double wall_seconds;
+    struct timespec thread_start;
+    struct timespec episode_start;
+    int episodes_timed;
+    double episode_min;
+    double episode_max;
+    double episode_sum;
+    long episode_hist[LATENCY_BUCKETS];
+
+    // Hardware counters (--perf) over the sample loops (paused in end_episode); -1 when unavailable
+    int perf_fds[NUM_COUNTERS];
+    long long counters[NUM_COUNTERS];
+
+    // Timeline (--trace)
+    TraceRing trace;
+    uint64_t trace_episode_start;
+
+    QStatsThread* stats;  // This thread's record in the --stats page, NULL when off
 } ThreadData;
 
 typedef enum {
     SEQUENTIAL = 0,
     RANDOM, 
     STRIDE,
+    BACKWARD,     // Replay each trajectory from its last step to its first
 } sampling ;
 
 typedef enum  {
     QLEARN = 0,
-    SARSA
+    SARSA,
+    QLAMBDA,      // Watkins Q(lambda) over logged trajectories
+    SARSALAMBDA,  // SARSA(lambda) over logged trajectories
+    SARSALOGGED   // SARSA bootstrapping from the logged next action (5-field data)
 } algorithm;
 
+typedef enum {
+    SAMPLE = 0,   // Replay the dataset through update_q_table / update_q_table_sarsa
+    MODEL,        // Aggregate the dataset into an empirical MDP and run value iteration
+    PSWEEP,       // Prioritized sweeping over the empirical MDP
+    SWEEP         // Sample-based, one table per (alpha, gamma, epsilon) configuration
+} engine;
+
+typedef enum {
+    ONLINE = 0,   // Apply every sample as soon as it is drawn
+    BATCH_SUM,    // Gather BATCH_SIZE samples, apply the summed TD error per (s,a) (step grows with duplicates)
+    BATCH_MEAN    // Gather BATCH_SIZE samples, apply the averaged TD error per (s,a)
+} update_mode;
+
+// Storage of the SAMPLE engine's per-thread tables
+typedef enum {
+    TABLE_DENSE = 0,  // q_tables[thread][state][action], up to NUM_STATES states
+    TABLE_HASH        // A QHash per thread holding only the states the data updates
+} table_backend;
+
+typedef enum {
+    REPORT_JSON = 0,
+    REPORT_CSV
+} report_format;
+
+// Wall-clock phases of a run, reported by --report
+typedef enum {
+    PHASE_LOAD = 0,
+    PHASE_INIT,
+    PHASE_TRAIN,
+    PHASE_MERGE,
+    PHASE_OUTPUT,
+    PHASE_EVAL,
+    NUM_PHASES
+} phase;
+
+const char* phase_names[NUM_PHASES] = { "load", "init", "train", "merge", "output", "eval" };
+
+// Spans recorded by --trace: the phases above on the main thread, then the
+// workers' episode-boundary spans
+typedef enum {
+    TRACE_EPISODE = NUM_PHASES,  // A pass over the thread's samples
+    TRACE_CONVERGENCE,           // Diffing the table against the previous episode (--tol)
+    TRACE_BARRIER,               // Waiting for the other threads at an episode boundary (--tol)
+    TRACE_SNAPSHOT,              // Copying the thread's state for --state-file
+    TRACE_PUBLISH,               // Copying (and, last to arrive, merging) the table for --publish
+    NUM_TRACE_NAMES
+} trace_name;
+
+const char* trace_names[NUM_TRACE_NAMES] = { "load", "init", "train", "merge", "output", "eval", "episode", "convergence", "barrier", "snapshot", "publish" };
+
+// Dynamics --evaluate rolls the greedy policy out in
+typedef enum {
+    EVAL_MODEL = 0,       // Empirical MDP of the loaded dataset, started from its trajectories' first states
+    EVAL_FROZENLAKE4X4,   // Gym FrozenLake (16 x 4), as generated by gen_experiences
+    EVAL_FROZENLAKE8X8,   // (64 x 4)
+    EVAL_TAXI             // Gym Taxi-v3 (500 x 6)
+} eval_environment;
+
+typedef enum {
+    PRINT_ALL = 0,  // Every per-thread table
+    PRINT_MERGED,   // The mean of the per-thread tables
+    PRINT_GREEDY,   // The greedy action and its value per state, from the merged table
+    PRINT_NONE
+} print_mode;
+
 algorithm algorithm_type = QLEARN;
 sampling sampling_type = SEQUENTIAL;
+update_mode update_type = ONLINE;
+engine engine_type = SAMPLE;
+table_backend table_type = TABLE_DENSE;
+print_mode print_type = PRINT_ALL;
+char* checkpoint_path = NULL;  // --checkpoint: binary dump of the final tables
+char* policy_path = NULL;      // --policy: greedy action per state of the merged table(s)
+int eval_episodes = 0;         // --evaluate: rollouts of the greedy policy, 0 for none
+eval_environment eval_env_type = EVAL_MODEL;
+int eval_horizon = 0;          // Steps per rollout; 0 for the environment's own limit
+uint64_t eval_seed = EVAL_SEED;
+int eval_slippery = 1;
+char* report_path = NULL;      // --report: timing report, "-" for stdout
+report_format report_type = REPORT_JSON;
+double phase_seconds[NUM_PHASES];
+char* trace_path = NULL;       // --trace: Chrome trace-event timeline
+struct timespec trace_origin;
+TraceRing main_trace;
+
+// --perf: per-thread counters via perf_event_open, user space only so the
+// default perf_event_paranoid setting allows them. They count the sample
+// loops of the SAMPLE and SWEEP engines and pause during end_episode.
+int perf_enabled = 0;
+atomic_int perf_warned = 0;
+const char* counter_names[NUM_COUNTERS] = { "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "branch_misses" };
+const uint32_t counter_types[NUM_COUNTERS] = {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE
+};
+const uint64_t counter_configs[NUM_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    PERF_COUNT_HW_BRANCH_MISSES
+};
 int num_actions = NUM_ACTIONS;
 int num_states = NUM_STATES;
+int num_threads = NUM_THREADS;
+int num_episodes = NUM_EPISODES;  // Passes over the data (SAMPLE, SWEEP), sweeps (MODEL) or backups per (s,a) (PSWEEP)
+
+// --renumber: training sees states numbered by descending visit count.
+// state_ids maps those IDs back to the original ones and state_ranks the
+// other way; both are NULL when off.
+int renumber_states = 0;
+int* state_ids = NULL;
+int* state_ranks = NULL;
+int visited_states = 0;
+
+// --actions: per-state action sets. Row s of a ragged table holds Q(s, a)
+// for a = action_sets[action_offsets[s]] .. action_sets[action_offsets[s + 1] - 1]
+// in that order, and while training the dataset's action and next_action
+// are positions in their state's row.
+char* actions_source = NULL;  // "DATA" to infer the sets from the samples, else a file
+int* action_offsets = NULL;   // num_states + 1
+int* action_sets = NULL;
+
+// --fixed: Q values as signed fixed_width-bit integers scaled by 2^fixed_frac
+int fixed_width = 0;       // 16 or 32, 0 when off
+int fixed_frac = 0;
+int fixed_check = 0;       // --fixed-check: train the double tables alongside and report the error
+int64_t fixed_alpha = 0;   // ALPHA and GAMMA scaled by 2^FIXED_COEFF_BITS
+int64_t fixed_gamma = 0;
+int32_t* fixed_rewards = NULL;  // Each sample's reward, scaled and saturated
+
+// Trajectory t covers dataset[traj_offsets[t]] .. dataset[traj_offsets[t + 1] - 1]
+int* traj_offsets = NULL;
+int num_trajectories = 0;
+int num_logged_actions = 0;   // Samples that came with a logged next action
+
+double lambda = LAMBDA;
+double trace_cutoff = TRACE_CUTOFF;
+
+// SWEEP grid: the cartesian product of the --alphas/--gammas/--epsilons lists
+int num_configs = 1;
+int config_stride = SWEEP_LANES;  // num_configs rounded up to whole SWEEP_LANES blocks
+double sweep_alpha[MAX_SWEEP_CONFIGS] = { ALPHA };
+double sweep_gamma[MAX_SWEEP_CONFIGS] = { GAMMA };
+double sweep_epsilon[MAX_SWEEP_CONFIGS] = { EPSILON };
+
+// Early stopping: a tolerance of 0 runs all num_episodes
+double convergence_tol = 0.0;
+int convergence_patience = CONVERGENCE_PATIENCE;
+pthread_barrier_t episode_barrier;
+ThreadData* all_thread_data;
+int stop_training = 0;
+int converged_streak = 0;
+int converged_episode = -1;
+int episodes_run = 0;
+double last_delta_max = 0.0;
+double last_delta_mean = 0.0;
+
+// Training state snapshots (--state-file): every save_every episodes each
+// worker copies its state into the round's buffer and carries on; a writer
+// thread puts completed rounds on disk. Two buffers let round r+1 fill while
+// round r is being written.
+char* state_path = NULL;
+int save_every = SAVE_EVERY;
+int resume = 0;
+typedef struct {
+    QStateHeader* header;
+    size_t bytes;
+    int round;        // Round being filled or written, -1 when free
+    int deposited;    // Threads that have copied their state into this round
+    int ready;        // All threads deposited, waiting for the writer
+} Snapshot;
+Snapshot snapshots[2];
+pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t snapshot_cond = PTHREAD_COND_INITIALIZER;
+int snapshot_shutdown = 0;
+
+// Table publishing (--publish): every publish_every episodes each worker
+// copies its table into the round's staging buffer, and the last one to
+// arrive merges the round into the free slot of the shared QPublishHeader
+// mapping. As with snapshots, two staging buffers let round r+1 fill while
+// round r is being merged.
+char* publish_path = NULL;
+int publish_every = PUBLISH_EVERY;
+QPublishHeader* publish_page = NULL;
+size_t publish_bytes = 0;
+size_t publish_doubles = 0;  // Doubles per thread table (NUM_ACTIONS * config_stride per state for SWEEP)
+typedef struct {
+    double* tables;   // num_threads copies of publish_doubles
+    int round;        // Round being filled, -1 when free
+    int deposited;
+} PublishRound;
+PublishRound publish_rounds[2];
+pthread_mutex_t publish_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t publish_cond = PTHREAD_COND_INITIALIZER;
+pthread_mutex_t publish_page_lock = PTHREAD_MUTEX_INITIALIZER;  // One merge writes the page at a time
+
+// Live progress page (--stats), laid out as a QStatsHeader
+char* stats_path = NULL;
+QStatsHeader* stats_page = NULL;
+size_t stats_bytes = 0;
 
 //pthread_mutex_t q_table_mutex = PTHREAD_MUTEX_INITIALIZER;
 // Define LCG parameters
@@ -64,120 +386,3136 @@ int num_states = NUM_STATES;
 
 
 
-void update_q_table(Experience experience, double (*q_table)[NUM_ACTIONS]) {
-    int s = experience.state;
-    int a = experience.action;
-    double r = experience.reward;
-    int next_s = experience.next_state;
+double elapsed_seconds(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// Nanoseconds since the start of the run
+uint64_t trace_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - trace_origin.tv_sec) * 1000000000ull + now.tv_nsec - trace_origin.tv_nsec;
+}
+
+// Start of a span, or 0 without --trace so untraced runs never read the clock
+uint64_t trace_begin(const TraceRing* ring) {
+    return ring->events != NULL ? trace_clock() : 0;
+}
+
+void trace_end(TraceRing* ring, int name, uint64_t start, int arg) {
+    if (ring->events == NULL)
+        return;
+    TraceEvent* event = &ring->events[ring->written & (TRACE_RING_EVENTS - 1)];
+    event->start = start;
+    event->duration = trace_clock() - start;
+    event->name = name;
+    event->arg = arg;
+    ring->written++;
+}
+
+double seconds_since(struct timespec start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return elapsed_seconds(start, now);
+}
+
+// The TD updates work on rows, Q(s, .) and Q(s', .), so the dense tables,
+// the sparse ones of --table=HASH and the ragged ones of --actions run the
+// same arithmetic (qkernel_update_row, which mem_bench times as well).
+// next_count is the number of actions in next_row.
+void update_q_row(Experience experience, double* row, const double* next_row, int next_count) {
+    //pthread_mutex_lock(&q_table_mutex);
+    qkernel_update_row(row, experience.action, experience.reward, next_row, next_count, ALPHA, GAMMA);
+    //pthread_mutex_unlock(&q_table_mutex);
+}
+
+void update_q_table(Experience experience, double (*q_table)[NUM_ACTIONS]) {
+    update_q_row(experience, q_table[experience.state], q_table[experience.next_state], num_actions);
+}
+
+// Function to choose the next action based on the epsilon-greedy policy;
+// -1 for a state with no actions (a terminal state of a ragged table)
+int sarsa_choose_row_action(unsigned int *seed, const double* row, int count) {
+    if (count == 0)
+        return -1;
+    double rand_val = custom_rand(seed) / 4294967296.0;  // Uniform in [0, 1)
+    if (rand_val < EPSILON) {
+        // Exploration: choose a random action
+        return custom_rand(seed) % count;
+    } else {
+        // Exploitation: choose the best action based on the Q-table
+        int best_action = 0;
+        double best_value = row[0];
+        for (int a = 1; a < count; a++) {
+            if (row[a] > best_value) {
+                best_value = row[a];
+                best_action = a;
+            }
+        }
+        return best_action;
+    }
+}
+
+int sarsa_choose_action(unsigned int *seed, int state, double (*q_table)[NUM_ACTIONS]) {
+    return sarsa_choose_row_action(seed, q_table[state], num_actions);
+}
+
+void update_q_row_sarsa(unsigned int *seed, Experience experience, double* row, const double* next_row, int next_count) {
+    int a = experience.action;
+    double r = experience.reward;
+
+    // Determine the next action based on the current policy
+    int next_a = sarsa_choose_row_action(seed, next_row, next_count);
+
+    // SARSA Q-value update
+    double next_q = next_a >= 0 ? next_row[next_a] : 0.0;
+    row[a] += ALPHA * (r + GAMMA * next_q - row[a]);
+}
+
+void update_q_table_sarsa(unsigned int *seed, Experience experience, double (*q_table)[NUM_ACTIONS]) {
+    update_q_row_sarsa(seed, experience, q_table[experience.state], q_table[experience.next_state], num_actions);
+}
+
+// Offline SARSA: the next action is the one actually taken in the log, so
+// there is no RNG call or argmax on the hot path. A missing next action
+// (terminal step) bootstraps from 0.
+void update_q_row_sarsa_logged(Experience experience, double* row, const double* next_row) {
+    int a = experience.action;
+    double r = experience.reward;
+    int next_a = experience.next_action;
+
+    double next_q = next_a >= 0 ? next_row[next_a] : 0.0;
+    row[a] += ALPHA * (r + GAMMA * next_q - row[a]);
+}
+
+void update_q_table_sarsa_logged(Experience experience, double (*q_table)[NUM_ACTIONS]) {
+    update_q_row_sarsa_logged(experience, q_table[experience.state], q_table[experience.next_state]);
+}
+
+void update_q_rows(unsigned int *seed, Experience experience, double* row, const double* next_row, int next_count) {
+    if (algorithm_type == QLEARN)
+        update_q_row(experience, row, next_row, next_count);
+    else if (algorithm_type == SARSA)
+        update_q_row_sarsa(seed, experience, row, next_row, next_count);
+    else
+        update_q_row_sarsa_logged(experience, row, next_row);
+}
+
+// --table=HASH: the row of s is created on its first update, while a next
+// state without a row bootstraps from zeros. s is inserted before s' is
+// looked up, so s == s' finds the new row.
+void update_q_hash(unsigned int *seed, Experience experience, QHash* table) {
+    double* row = qhash_insert(table, experience.state);
+    // Tables are sized from the states each thread's samples hold, so this
+    // means that sizing is wrong; stop rather than write through NULL
+    if (row == NULL) {
+        fprintf(stderr, "Sparse Q-table full at state %d\n", experience.state);
+        exit(EXIT_FAILURE);
+    }
+    const double* next_row = qhash_find(table, experience.next_state);
+    update_q_rows(seed, experience, row, next_row, num_actions);
+}
+
+// --actions: the rows of a ragged table only hold the state's own actions,
+// and the dataset's actions are already indices into those rows
+void update_q_ragged(unsigned int *seed, Experience experience, double* table) {
+    int next_start = action_offsets[experience.next_state];
+    update_q_rows(seed, experience, table + action_offsets[experience.state], table + next_start,
+                  action_offsets[experience.next_state + 1] - next_start);
+}
+
+// --fixed: Q values as signed fixed_width-bit integers scaled by
+// 2^fixed_frac. Products with ALPHA and GAMMA (fixed_alpha, fixed_gamma) are
+// rounded back by FIXED_COEFF_BITS, and every store saturates to the width,
+// counting each time it had to. width is a constant at every call, so each
+// width gets its own copy of the loops.
+static inline int64_t fixed_get(const void* row, int action, int width) {
+    return width == 16 ? ((const int16_t*)row)[action] : ((const int32_t*)row)[action];
+}
+
+static inline int64_t fixed_scale(int64_t coeff, int64_t value) {
+    return (coeff * value + (1 << (FIXED_COEFF_BITS - 1))) >> FIXED_COEFF_BITS;
+}
+
+static inline void fixed_set(void* row, int action, int64_t value, int width, long* saturations) {
+    int64_t limit = width == 16 ? INT16_MAX : INT32_MAX;
+    if (value > limit || value < -limit) {
+        value = value > limit ? limit : -limit;
+        (*saturations)++;
+    }
+    if (width == 16)
+        ((int16_t*)row)[action] = (int16_t)value;
+    else
+        ((int32_t*)row)[action] = (int32_t)value;
+}
+
+// sarsa_choose_row_action over a fixed-point row, drawing the same numbers
+static inline int sarsa_choose_fixed_action(unsigned int *seed, const void* row, int width) {
+    double rand_val = custom_rand(seed) / 4294967296.0;  // Uniform in [0, 1)
+    if (rand_val < EPSILON)
+        return custom_rand(seed) % num_actions;
+    int best_action = 0;
+    for (int a = 1; a < num_actions; a++) {
+        if (fixed_get(row, a, width) > fixed_get(row, best_action, width))
+            best_action = a;
+    }
+    return best_action;
+}
+
+static inline void update_q_fixed(unsigned int *seed, ThreadData* data, int index, int width) {
+    Experience experience = data->dataset[index];
+    size_t row_bytes = (size_t)num_actions * (width / 8);
+    char* row = (char*)data->fixed_table + experience.state * row_bytes;
+    const char* next_row = (const char*)data->fixed_table + experience.next_state * row_bytes;
+
+    int64_t next_q = 0;
+    if (algorithm_type == QLEARN) {
+        for (int next_a = 0; next_a < num_actions; next_a++) {
+            if (fixed_get(next_row, next_a, width) > next_q)
+                next_q = fixed_get(next_row, next_a, width);
+        }
+    } else if (algorithm_type == SARSA) {
+        next_q = fixed_get(next_row, sarsa_choose_fixed_action(seed, next_row, width), width);
+    } else if (experience.next_action >= 0) {
+        next_q = fixed_get(next_row, experience.next_action, width);
+    }
+    int64_t q = fixed_get(row, experience.action, width);
+    int64_t target = fixed_rewards[index] + fixed_scale(fixed_gamma, next_q);
+    fixed_set(row, experience.action, q + fixed_scale(fixed_alpha, target - q), width, &data->saturations);
+}
+
+void update_q_table_fixed(unsigned int *seed, ThreadData* data, int index) {
+    if (fixed_width == 16)
+        update_q_fixed(seed, data, index, 16);
+    else
+        update_q_fixed(seed, data, index, 32);
+    // --fixed-check: the double table follows the same samples, with its own
+    // copy of the RNG so both draw the same numbers
+    if (fixed_check) {
+        if (algorithm_type == QLEARN)
+            update_q_table(data->dataset[index], data->q_table);
+        else if (algorithm_type == SARSA)
+            update_q_table_sarsa(&data->check_seed, data->dataset[index], data->q_table);
+        else
+            update_q_table_sarsa_logged(data->dataset[index], data->q_table);
+    }
+}
+
+double fixed_value(const void* table, int state, int action) {
+    int64_t q = fixed_get((const char*)table + (size_t)state * num_actions * (fixed_width / 8), action, fixed_width);
+    return ldexp((double)q, -fixed_frac);
+}
+
+// After training: the fixed-point result, with the error against the double
+// tables when --fixed-check trained them. The merged tables are compared, as
+// that is what --policy and --print=GREEDY read.
+void report_fixed_point(const ThreadData* threads, int n) {
+    long saturations = 0;
+    for (int t = 0; t < n; t++)
+        saturations += threads[t].saturations;
+    printf("Fixed point: %d-bit, %d fraction bits (resolution %g, range +/-%g), %ld saturated updates\n", fixed_width,
+           fixed_frac, ldexp(1.0, -fixed_frac), ldexp(fixed_width == 16 ? INT16_MAX : INT32_MAX, -fixed_frac), saturations);
+    if (!fixed_check)
+        return;
+
+    double max_error = 0.0, sum_error = 0.0;
+    int policy_changes = 0;
+    for (int state = 0; state < num_states; state++) {
+        double fixed_row[NUM_ACTIONS], double_row[NUM_ACTIONS];
+        int fixed_best = 0, double_best = 0;
+        for (int action = 0; action < num_actions; action++) {
+            double fixed_sum = 0.0, double_sum = 0.0;
+            for (int t = 0; t < n; t++) {
+                fixed_sum += fixed_value(threads[t].fixed_table, state, action);
+                double_sum += threads[t].q_table[state][action];
+            }
+            fixed_row[action] = fixed_sum / n;
+            double_row[action] = double_sum / n;
+            double error = fabs(fixed_row[action] - double_row[action]);
+            if (error > max_error)
+                max_error = error;
+            sum_error += error;
+            if (fixed_row[action] > fixed_row[fixed_best])
+                fixed_best = action;
+            if (double_row[action] > double_row[double_best])
+                double_best = action;
+        }
+        policy_changes += fixed_best != double_best;
+    }
+    printf("Fixed point against double: max |error| %g, mean |error| %g, greedy action differs in %d of %d states\n",
+           max_error, sum_error / ((double)num_states * num_actions), policy_changes, num_states);
+}
+
+// Mini-batch update: every TD error in the batch is computed against the same
+// table, then the errors are merged per (s,a) so each slot is written once.
+void update_q_table_batch(unsigned int *seed, ThreadData* data) {
+    double (*q_table)[NUM_ACTIONS] = data->q_table;
+    double* q_flat = &q_table[0][0];
+    int n = data->batch_len;
+
+    // Read phase: TD errors against the current table
+    for (int j = 0; j < n; j++) {
+        Experience experience = data->dataset[data->batch_indices[j]];
+        int next_s = experience.next_state;
+        double next_q = 0;
+
+        if (algorithm_type == QLEARN) {
+            for (int next_a = 0; next_a < num_actions; next_a++) {
+                if (q_table[next_s][next_a] > next_q) {
+                    next_q = q_table[next_s][next_a];
+                }
+            }
+        } else if (algorithm_type == SARSALOGGED) {
+            next_q = experience.next_action >= 0 ? q_table[next_s][experience.next_action] : 0.0;
+        } else {
+            next_q = q_table[next_s][sarsa_choose_action(seed, next_s, q_table)];
+        }
+
+        data->batch_slots[j] = experience.state * NUM_ACTIONS + experience.action;
+        data->batch_td[j] = experience.reward + GAMMA * next_q;
+    }
+    for (int j = 0; j < n; j++) {
+        data->batch_td[j] -= q_flat[data->batch_slots[j]];
+    }
+
+    // Merge duplicate (s,a) pairs
+    int num_touched = 0;
+    for (int j = 0; j < n; j++) {
+        int slot = data->batch_slots[j];
+        if (data->batch_count[slot] == 0) {
+            data->batch_touched[num_touched++] = slot;
+        }
+        data->batch_delta[slot] += data->batch_td[j];
+        data->batch_count[slot]++;
+    }
+
+    // Write phase: one store per touched slot
+    for (int k = 0; k < num_touched; k++) {
+        int slot = data->batch_touched[k];
+        double step = (update_type == BATCH_MEAN) ? ALPHA / data->batch_count[slot] : ALPHA;
+        q_flat[slot] += step * data->batch_delta[slot];
+        data->batch_delta[slot] = 0.0;
+        data->batch_count[slot] = 0;
+    }
+
+    data->batch_len = 0;
+}
+
+// End (exclusive) of the trajectory containing sample index
+int trajectory_end(int index) {
+    int lo = 0, hi = num_trajectories;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (traj_offsets[mid] <= index)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return traj_offsets[lo + 1];
+}
+
+// Q(lambda) / SARSA(lambda) step with replacing traces. Traces live in a
+// short per-thread list, so a step costs O(active traces) rather than a
+// sweep over the whole table. Traces are only carried between consecutive
+// samples of the same trajectory; any jump (new pass, RANDOM or STRIDE
+// sampling, trajectory boundary) starts from an empty list. BACKWARD
+// sampling would jump on every sample, so run_job rejects it.
+void update_q_table_lambda(unsigned int *seed, ThreadData* data, int index) {
+    double (*q_table)[NUM_ACTIONS] = data->q_table;
+    double* q_flat = &q_table[0][0];
+    Experience experience = data->dataset[index];
+    int s = experience.state;
+    int a = experience.action;
+    int next_s = experience.next_state;
+
+    if (index != data->last_index + 1 || index >= data->trace_end) {
+        data->trace_len = 0;
+        data->trace_end = trajectory_end(index);
+    }
+    data->last_index = index;
+
+    // The logged next action, if the data has it or the trajectory continues
+    int logged_next_a = experience.next_action;
+    if (logged_next_a < 0 && index + 1 < data->trace_end)
+        logged_next_a = data->dataset[index + 1].action;
+
+    double row_max = q_table[next_s][0];
+    for (int next_a = 1; next_a < num_actions; next_a++) {
+        if (q_table[next_s][next_a] > row_max)
+            row_max = q_table[next_s][next_a];
+    }
+
+    double next_q;
+    int cut_traces = 0;
+    if (algorithm_type == QLAMBDA) {
+        next_q = row_max > 0 ? row_max : 0;
+        // Watkins: traces stop at the first exploratory (non-greedy) action
+        cut_traces = logged_next_a >= 0 && q_table[next_s][logged_next_a] < row_max;
+    } else {
+        int next_a = logged_next_a >= 0 ? logged_next_a : sarsa_choose_action(seed, next_s, q_table);
+        next_q = q_table[next_s][next_a];
+    }
+    double td = experience.reward + GAMMA * next_q - q_table[s][a];
+
+    // Replacing trace for (s,a); evict the weakest trace when the list is full
+    int slot = s * NUM_ACTIONS + a;
+    int k = 0;
+    while (k < data->trace_len && data->trace_slots[k] != slot)
+        k++;
+    if (k == data->trace_len) {
+        if (data->trace_len == TRACE_CAPACITY) {
+            k = 0;
+            for (int j = 1; j < data->trace_len; j++) {
+                if (data->trace_values[j] < data->trace_values[k])
+                    k = j;
+            }
+        } else {
+            data->trace_len++;
+        }
+        data->trace_slots[k] = slot;
+    }
+    data->trace_values[k] = 1.0;
+
+    double decay = GAMMA * lambda;
+    for (int j = 0; j < data->trace_len; ) {
+        q_flat[data->trace_slots[j]] += ALPHA * td * data->trace_values[j];
+        data->trace_values[j] *= decay;
+        if (data->trace_values[j] < trace_cutoff) {
+            data->trace_len--;
+            data->trace_slots[j] = data->trace_slots[data->trace_len];
+            data->trace_values[j] = data->trace_values[data->trace_len];
+        } else {
+            j++;
+        }
+    }
+
+    if (cut_traces)
+        data->trace_len = 0;
+}
+
+// One sample applied to every configuration of the sweep. Configurations are
+// processed in blocks of SWEEP_LANES adjacent lanes whose running maxima stay
+// in registers, so the row max and the update vectorise across
+// configurations while the experience itself is read once.
+void update_q_table_sweep(unsigned int *seed, ThreadData* data, int index) {
+    Experience experience = data->dataset[index];
+    int stride = config_stride;
+    double* next_row = data->sweep_table + (size_t)experience.next_state * NUM_ACTIONS * stride;
+    double* cell = data->sweep_table + ((size_t)experience.state * NUM_ACTIONS + experience.action) * stride;
+
+    // SARSA: one shared uniform draw decides which configurations explore
+    // (common random numbers), and they all explore the same action
+    double u = 1.0;
+    int explore_action = 0;
+    if (algorithm_type == SARSA) {
+        u = custom_rand(seed) / 4294967296.0;
+        explore_action = custom_rand(seed) % num_actions;
+    }
+
+    for (int c0 = 0; c0 < stride; c0 += SWEEP_LANES) {
+        double next_q[SWEEP_LANES];
+
+        if (algorithm_type == QLEARN) {
+            for (int l = 0; l < SWEEP_LANES; l++)
+                next_q[l] = 0;
+            for (int next_a = 0; next_a < num_actions; next_a++) {
+                double* lane = next_row + next_a * stride + c0;
+                for (int l = 0; l < SWEEP_LANES; l++)
+                    next_q[l] = lane[l] > next_q[l] ? lane[l] : next_q[l];
+            }
+        } else {
+            for (int l = 0; l < SWEEP_LANES; l++)
+                next_q[l] = next_row[c0 + l];
+            for (int next_a = 1; next_a < num_actions; next_a++) {
+                double* lane = next_row + next_a * stride + c0;
+                for (int l = 0; l < SWEEP_LANES; l++)
+                    next_q[l] = lane[l] > next_q[l] ? lane[l] : next_q[l];
+            }
+            for (int l = 0; l < SWEEP_LANES; l++) {
+                if (u < sweep_epsilon[c0 + l])
+                    next_q[l] = next_row[explore_action * stride + c0 + l];
+            }
+        }
+
+        // Padding lanes have alpha = 0 and stay at zero
+        for (int l = 0; l < SWEEP_LANES; l++)
+            cell[c0 + l] += sweep_alpha[c0 + l] * (experience.reward + sweep_gamma[c0 + l] * next_q[l] - cell[c0 + l]);
+    }
+}
+
+void process_sample(unsigned int *seed, ThreadData* data, int index) {
+    if (engine_type == SWEEP) {
+        update_q_table_sweep(seed, data, index);
+    } else if (update_type != ONLINE) {
+        data->batch_indices[data->batch_len++] = index;
+        if (data->batch_len == BATCH_SIZE)
+            update_q_table_batch(seed, data);
+    } else if (data->hash_table != NULL) {
+        update_q_hash(seed, data->dataset[index], data->hash_table);
+    } else if (data->ragged_table != NULL) {
+        update_q_ragged(seed, data->dataset[index], data->ragged_table);
+    } else if (data->fixed_table != NULL) {
+        update_q_table_fixed(seed, data, index);
+    } else if (algorithm_type == QLEARN) {
+        update_q_table(data->dataset[index], data->q_table);
+    } else if (algorithm_type == SARSA) {
+        update_q_table_sarsa(seed, data->dataset[index], data->q_table);
+    } else if (algorithm_type == SARSALOGGED) {
+        update_q_table_sarsa_logged(data->dataset[index], data->q_table);
+    } else {
+        update_q_table_lambda(seed, data, index);
+    }
+}
+
+// Apply whatever is left of a partial batch at the end of a pass
+void flush_batch(unsigned int *seed, ThreadData* data) {
+    if (data->batch_len > 0)
+        update_q_table_batch(seed, data);
+}
+
+// Copy this thread's state at the end of episode into the snapshot of that
+// round; only blocks if the buffer still holds the round before last.
+void save_thread_state(ThreadData* data, int episode) {
+    int round = episode / save_every;
+    Snapshot* snap = &snapshots[round % 2];
+
+    pthread_mutex_lock(&snapshot_lock);
+    while (snap->round != round && snap->round != -1)
+        pthread_cond_wait(&snapshot_cond, &snapshot_lock);
+    if (snap->round == -1) {
+        snap->round = round;
+        snap->deposited = 0;
+    }
+    pthread_mutex_unlock(&snapshot_lock);
+
+    QStateHeader* header = snap->header;
+    char* record = (char*)header + header->header_size + (size_t)data->thread_id * header->record_size;
+    QStateThread* thread_state = (QStateThread*)record;
+    thread_state->seed = data->seed;
+    thread_state->rand_seed = data->rand_seed;
+    thread_state->converged_streak = data->converged_streak;
+    thread_state->converged_episode = data->converged_episode;
+    double* table = (double*)(record + sizeof(QStateThread));
+    if (data->sweep_table != NULL)
+        memcpy(table, data->sweep_table, header->table_doubles * sizeof(double));
+    else
+        memcpy(table, data->q_table, header->table_doubles * sizeof(double));
+    if (header->prev_doubles > 0)
+        memcpy(table + header->table_doubles, data->prev_q_table, header->prev_doubles * sizeof(double));
+
+    pthread_mutex_lock(&snapshot_lock);
+    if (++snap->deposited == num_threads) {
+        // Globals are stable here: the next change happens at a barrier this thread has not reached
+        header->episode = episode;
+        header->converged_streak = converged_streak;
+        header->last_delta_max = last_delta_max;
+        header->last_delta_mean = last_delta_mean;
+        snap->ready = 1;
+        pthread_cond_broadcast(&snapshot_cond);
+    }
+    pthread_mutex_unlock(&snapshot_lock);
+}
+
+// PERF_EVENT_IOC_ENABLE or PERF_EVENT_IOC_DISABLE on every open counter
+void switch_thread_counters(ThreadData* data, unsigned long request) {
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        if (data->perf_fds[c] >= 0)
+            ioctl(data->perf_fds[c], request, 0);
+    }
+}
+
+// Open the calling thread's counters and start them; an event the CPU,
+// kernel or container does not provide is skipped and reported as unavailable
+void open_thread_counters(ThreadData* data) {
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counter_types[c];
+        attr.config = counter_configs[c];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        data->perf_fds[c] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (data->perf_fds[c] < 0 && atomic_exchange(&perf_warned, 1) == 0)
+            fprintf(stderr, "Hardware counter %s unavailable (%s); unavailable counters are reported as n/a\n", counter_names[c], strerror(errno));
+    }
+    switch_thread_counters(data, PERF_EVENT_IOC_ENABLE);
+}
+
+// Stop and read the counters, scaling up events the kernel had to multiplex
+void close_thread_counters(ThreadData* data) {
+    switch_thread_counters(data, PERF_EVENT_IOC_DISABLE);
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        uint64_t values[3];  // value, time enabled, time running
+        data->counters[c] = -1;
+        if (data->perf_fds[c] < 0)
+            continue;
+        if (read(data->perf_fds[c], values, sizeof(values)) == (ssize_t)sizeof(values) && values[2] > 0)
+            data->counters[c] = (long long)((double)values[0] * values[1] / values[2]);
+        close(data->perf_fds[c]);
+        data->perf_fds[c] = -1;
+    }
+}
+
+void begin_thread_timing(ThreadData* data) {
+    if (perf_enabled)
+        open_thread_counters(data);
+    clock_gettime(CLOCK_MONOTONIC, &data->thread_start);
+    data->episode_start = data->thread_start;
+    data->trace_episode_start = trace_begin(&data->trace);
+}
+
+// Latency of the episode that just ended, boundary to boundary
+double record_episode_time(ThreadData* data) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = elapsed_seconds(data->episode_start, now);
+    data->episode_start = now;
+    data->updates += data->pass_samples;
+
+    if (data->episodes_timed == 0 || seconds < data->episode_min)
+        data->episode_min = seconds;
+    if (seconds > data->episode_max)
+        data->episode_max = seconds;
+    data->episode_sum += seconds;
+    data->episodes_timed++;
+
+    long us = (long)(seconds * 1e6);
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && (us >> (bucket + 1)) > 0)
+        bucket++;
+    data->episode_hist[bucket]++;
+    return seconds;
+}
+
+uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Rewrite this thread's --stats record: a few stores once per episode, and
+// the record's cache line belongs to this thread alone
+void publish_thread_stats(ThreadData* data, int episode, double episode_seconds) {
+    QStatsThread* record = data->stats;
+    if (record == NULL)
+        return;
+    uint64_t seq = atomic_load_explicit(&record->seq, memory_order_relaxed);
+    atomic_store_explicit(&record->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    record->episode = episode + 1;
+    record->updates = data->updates;
+    record->episode_seconds = episode_seconds;
+    record->delta_max = data->delta_max;
+    record->updated_ns = monotonic_ns();
+    atomic_store_explicit(&record->seq, seq + 2, memory_order_release);
+}
+
+void finish_thread_stats(ThreadData* data) {
+    QStatsThread* record = data->stats;
+    if (record == NULL)
+        return;
+    uint64_t seq = atomic_load_explicit(&record->seq, memory_order_relaxed);
+    atomic_store_explicit(&record->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    record->status = QSTATS_DONE;
+    record->updated_ns = monotonic_ns();
+    atomic_store_explicit(&record->seq, seq + 2, memory_order_release);
+}
+
+// Run-wide early-stopping statistics, written by the barrier's serial thread
+void publish_run_stats(void) {
+    if (stats_page == NULL)
+        return;
+    uint64_t seq = atomic_load_explicit(&stats_page->seq, memory_order_relaxed);
+    atomic_store_explicit(&stats_page->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    stats_page->episodes_run = episodes_run;
+    stats_page->last_delta_max = last_delta_max;
+    stats_page->last_delta_mean = last_delta_mean;
+    atomic_store_explicit(&stats_page->seq, seq + 2, memory_order_release);
+}
+
+// Write the mean of the threads' tables into the free slot of the --publish
+// page and make it the latest. tables[t] is laid out like a thread's own table.
+void publish_merged(const double* tables[], int episode) {
+    pthread_mutex_lock(&publish_page_lock);
+    uint64_t published = atomic_load_explicit(&publish_page->published, memory_order_relaxed);
+    // A round that finished merging after a later one is dropped
+    if (published > 0 && qpub_slot(publish_page, (int)(published % 2))->episode >= episode) {
+        pthread_mutex_unlock(&publish_page_lock);
+        return;
+    }
+    QPublishSlot* slot = qpub_slot(publish_page, (int)((published + 1) % 2));
+    uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    double* out = (double*)(slot + 1);
+    size_t lanes = engine_type == SWEEP ? (size_t)config_stride : 1;
+    for (uint32_t c = 0; c < publish_page->num_tables; c++) {
+        for (int state = 0; state < num_states; state++) {
+            int out_state = state_ids != NULL ? state_ids[state] : state;
+            for (int action = 0; action < num_actions; action++) {
+                size_t cell = ((size_t)state * NUM_ACTIONS + action) * lanes + c;
+                double sum = 0.0;
+                for (int t = 0; t < num_threads; t++)
+                    sum += tables[t][cell];
+                out[((size_t)c * num_states + out_state) * num_actions + action] = sum / num_threads;
+            }
+        }
+    }
+    slot->publication = published + 1;
+    slot->episode = episode;
+    slot->published_ns = monotonic_ns();
+    slot->num_threads = num_threads;
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+    atomic_store_explicit(&publish_page->published, published + 1, memory_order_release);
+    pthread_mutex_unlock(&publish_page_lock);
+}
+
+// Copy this thread's table into the staging buffer of its round; the last
+// thread to arrive publishes the round. Only blocks if the buffer still
+// holds the round before last.
+void publish_thread_table(ThreadData* data, int episode) {
+    int round = episode / publish_every;
+    PublishRound* pending = &publish_rounds[round % 2];
+
+    pthread_mutex_lock(&publish_lock);
+    while (pending->round != round && pending->round != -1)
+        pthread_cond_wait(&publish_cond, &publish_lock);
+    if (pending->round == -1) {
+        pending->round = round;
+        pending->deposited = 0;
+    }
+    pthread_mutex_unlock(&publish_lock);
+
+    const double* table = data->sweep_table != NULL ? data->sweep_table : &data->q_table[0][0];
+    memcpy(pending->tables + (size_t)data->thread_id * publish_doubles, table, publish_doubles * sizeof(double));
+
+    pthread_mutex_lock(&publish_lock);
+    int last = ++pending->deposited == num_threads;
+    pthread_mutex_unlock(&publish_lock);
+    if (!last)
+        return;
+
+    const double* tables[NUM_THREADS];
+    for (int t = 0; t < num_threads; t++)
+        tables[t] = pending->tables + (size_t)t * publish_doubles;
+    publish_merged(tables, episode);
+
+    pthread_mutex_lock(&publish_lock);
+    pending->round = -1;
+    pthread_cond_broadcast(&publish_cond);
+    pthread_mutex_unlock(&publish_lock);
+}
+
+void end_thread_timing(ThreadData* data) {
+    struct timespec cpu;
+    data->wall_seconds = seconds_since(data->thread_start);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    data->cpu_seconds = cpu.tv_sec + cpu.tv_nsec / 1e9;
+    if (perf_enabled)
+        close_thread_counters(data);
+    finish_thread_stats(data);
+}
+
+// Called by every thread after each pass. Per-thread |dQ| statistics are
+// combined at a barrier; returns 1 once all threads should stop.
+// The statistics come from diffing the table once per episode, which keeps
+// the update kernels themselves untouched.
+int end_episode(ThreadData* data, int episode) {
+    // Counters cover the sample loops, not the barrier, snapshot and publish below
+    if (perf_enabled)
+        switch_thread_counters(data, PERF_EVENT_IOC_DISABLE);
+    double episode_seconds = record_episode_time(data);
+    trace_end(&data->trace, TRACE_EPISODE, data->trace_episode_start, episode);
+
+    // Traces never carry over into the next pass
+    data->trace_len = 0;
+    data->last_index = -2;
+
+    if (convergence_tol > 0) {
+        uint64_t span_start = trace_begin(&data->trace);
+        data->delta_max = 0.0;
+        data->delta_sum = 0.0;
+        for (int state = 0; state < num_states; state++) {
+            for (int action = 0; action < num_actions; action++) {
+                double diff = data->q_table[state][action] - data->prev_q_table[state][action];
+                if (diff < 0)
+                    diff = -diff;
+                if (diff > data->delta_max)
+                    data->delta_max = diff;
+                data->delta_sum += diff;
+                data->prev_q_table[state][action] = data->q_table[state][action];
+            }
+        }
+        data->delta_count = (long)num_states * num_actions;
+
+        if (data->delta_max < convergence_tol) {
+            data->converged_streak++;
+            if (data->converged_streak == convergence_patience && data->converged_episode < 0)
+                data->converged_episode = episode;
+        } else {
+            data->converged_streak = 0;
+        }
+        trace_end(&data->trace, TRACE_CONVERGENCE, span_start, episode);
+    }
+
+    // Before the barrier, so a straggler's peers already show the new episode
+    publish_thread_stats(data, episode, episode_seconds);
+
+    if (convergence_tol > 0) {
+        uint64_t span_start = trace_begin(&data->trace);
+        if (pthread_barrier_wait(&episode_barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+            double max = 0.0, sum = 0.0;
+            long count = 0;
+            for (int t = 0; t < num_threads; t++) {
+                if (all_thread_data[t].delta_max > max)
+                    max = all_thread_data[t].delta_max;
+                sum += all_thread_data[t].delta_sum;
+                count += all_thread_data[t].delta_count;
+            }
+            last_delta_max = max;
+            last_delta_mean = count > 0 ? sum / count : 0.0;
+            episodes_run = episode + 1;
+
+            converged_streak = (max < convergence_tol) ? converged_streak + 1 : 0;
+            if (converged_streak == convergence_patience) {
+                converged_episode = episode;
+                stop_training = 1;
+            }
+            publish_run_stats();
+        }
+        // Second barrier: nobody overwrites its statistics or reads the flag early
+        pthread_barrier_wait(&episode_barrier);
+        trace_end(&data->trace, TRACE_BARRIER, span_start, episode);
+    }
+
+    if (state_path != NULL && !stop_training && (episode + 1) % save_every == 0) {
+        uint64_t span_start = trace_begin(&data->trace);
+        save_thread_state(data, episode);
+        trace_end(&data->trace, TRACE_SNAPSHOT, span_start, episode);
+    }
+    if (publish_page != NULL && !stop_training && (episode + 1) % publish_every == 0) {
+        uint64_t span_start = trace_begin(&data->trace);
+        publish_thread_table(data, episode);
+        trace_end(&data->trace, TRACE_PUBLISH, span_start, episode);
+    }
+
+    data->trace_episode_start = trace_begin(&data->trace);
+    if (perf_enabled)
+        switch_thread_counters(data, PERF_EVENT_IOC_ENABLE);
+    return stop_training;
+}
+
+
+void* update_seq_thread(void* thread_data) {
+    ThreadData* data = (ThreadData*)thread_data;
+    unsigned int seed = data->seed;
+    begin_thread_timing(data);
+
+    for (int episode = data->start_episode; episode < num_episodes; episode++) {
+        for (int i = data->start_index; i < data->end_index; i++) {
+            process_sample(&seed, data, i);
+        }
+        flush_batch(&seed, data);
+        data->seed = seed;
+        if (end_episode(data, episode))
+            break;
+    }
+
+    end_thread_timing(data);
+    pthread_exit(NULL);
+}
+
+void* update_rand_thread(void* thread_data) {
+    ThreadData* data = (ThreadData*)thread_data;
+    unsigned int seed = data->seed;
+    unsigned int rand_seed = data->rand_seed;
+    begin_thread_timing(data);
+
+    for (int episode = data->start_episode; episode < num_episodes; episode++) {
+        for (int i = data->start_index; i < data->end_index; i++) {
+            int random_index = custom_rand(&rand_seed) % (data->end_index - data->start_index) + data->start_index ;
+            process_sample(&seed, data, random_index);
+        }
+        flush_batch(&seed, data);
+        data->seed = seed;
+        data->rand_seed = rand_seed;
+        if (end_episode(data, episode))
+            break;
+    }
+
+    end_thread_timing(data);
+    pthread_exit(NULL);
+}
+
+void* update_stride_thread(void* thread_data) {
+    ThreadData* data = (ThreadData*)thread_data;
+    unsigned int seed = data->seed;
+    begin_thread_timing(data);
+
+    for (int episode = data->start_episode; episode < num_episodes; episode++) {
+        for (int stride_idx=0; stride_idx < NUM_STRIDE; stride_idx++) {
+            int size = data->end_index - data->start_index;
+            for (int i = 0; i < size / NUM_STRIDE; i++) {
+                int index = stride_idx + i * NUM_STRIDE;
+                process_sample(&seed, data, index);
+            }
+        }
+        flush_batch(&seed, data);
+        data->seed = seed;
+        if (end_episode(data, episode))
+            break;
+    }
+
+    end_thread_timing(data);
+    pthread_exit(NULL);
+}
+
+void* update_backward_thread(void* thread_data) {
+    ThreadData* data = (ThreadData*)thread_data;
+    unsigned int seed = data->seed;
+    begin_thread_timing(data);
+
+    for (int episode = data->start_episode; episode < num_episodes; episode++) {
+        for (int traj = data->traj_start; traj < data->traj_end; traj++) {
+            for (int i = traj_offsets[traj + 1] - 1; i >= traj_offsets[traj]; i--) {
+                process_sample(&seed, data, i);
+            }
+        }
+        flush_batch(&seed, data);
+        data->seed = seed;
+        if (end_episode(data, episode))
+            break;
+    }
+
+    end_thread_timing(data);
+    pthread_exit(NULL);
+}
+
+
+// Parse "state action reward next_state [next_action]"; returns the number
+// of fields read
+int parse_experience(char* line, Experience* experience) {
+    char* end;
+    experience->state = (int)strtol(line, &end, 10);
+    if (end == line)
+        return 0;
+    line = end;
+    experience->action = (int)strtol(line, &end, 10);
+    if (end == line)
+        return 1;
+    line = end;
+    experience->reward = strtod(line, &end);
+    if (end == line)
+        return 2;
+    line = end;
+    experience->next_state = (int)strtol(line, &end, 10);
+    if (end == line)
+        return 3;
+    line = end;
+    experience->next_action = (int)strtol(line, &end, 10);
+    if (end == line) {
+        experience->next_action = -1;
+        return 4;
+    }
+    return 5;
+}
+
+// Load up to max_samples experiences and record trajectory boundaries.
+// A trajectory ends at a blank line or a line starting with '#' (explicit
+// episode marker), or when a sample does not start where the previous one
+// ended (logs without markers).
+int load_dataset(FILE* file, Experience* dataset, int max_samples) {
+    char line[256];
+    int num_s = 0;
+    int boundary = 1;
+
+    traj_offsets = (int*)malloc((max_samples + 1) * sizeof(int));
+    if (traj_offsets == NULL) {
+        perror("Error allocating memory for trajectory offsets");
+        return -1;
+    }
+    num_trajectories = 0;
+    num_logged_actions = 0;
+
+    while (num_s < max_samples && fgets(line, sizeof(line), file) != NULL) {
+        char* p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+            boundary = 1;
+            continue;
+        }
+        Experience experience;
+        int fields = parse_experience(p, &experience);
+        if (fields < 4) {
+            fprintf(stderr, "Malformed experience on sample %d: %s", num_s, line);
+            continue;
+        }
+        if (num_s > 0 && experience.state != dataset[num_s - 1].next_state)
+            boundary = 1;
+        if (boundary) {
+            traj_offsets[num_trajectories++] = num_s;
+            boundary = 0;
+        }
+        if (fields == 5)
+            num_logged_actions++;
+        dataset[num_s] = experience;
+        num_s++;
+    }
+    traj_offsets[num_trajectories] = num_s;
+    return num_s;
+}
+
+// Binary dataset (qlearn_formats.h); the file position is just past the magic
+int load_binary_dataset(FILE* file, Experience* dataset, int max_samples) {
+    QExperienceHeader header;
+    memcpy(header.magic, QEXP_MAGIC, sizeof(header.magic));
+    if (fread((char*)&header + sizeof(header.magic), sizeof(header) - sizeof(header.magic), 1, file) != 1 ||
+        header.version != QEXP_VERSION || header.record_size != sizeof(Experience) ||
+        fseek(file, header.header_size, SEEK_SET) != 0) {
+        fprintf(stderr, "Unsupported binary experience file\n");
+        return -1;
+    }
+    int num_s = header.num_samples < (uint64_t)max_samples ? (int)header.num_samples : max_samples;
+    if (fread(dataset, sizeof(Experience), num_s, file) != (size_t)num_s) {
+        fprintf(stderr, "Binary experience file is truncated\n");
+        return -1;
+    }
+
+    traj_offsets = (int*)malloc((max_samples + 1) * sizeof(int));
+    if (traj_offsets == NULL) {
+        perror("Error allocating memory for trajectory offsets");
+        return -1;
+    }
+    num_trajectories = 0;
+    num_logged_actions = 0;
+    for (int i = 0; i < num_s; i++) {
+        if (i == 0 || dataset[i].state != dataset[i - 1].next_state)
+            traj_offsets[num_trajectories++] = i;
+        if (header.flags & QEXP_HAS_NEXT_ACTION)
+            num_logged_actions++;
+    }
+    traj_offsets[num_trajectories] = num_s;
+    return num_s;
+}
+
+// --renumber: one pass counts how often each state is read (as state or
+// next_state), then states are renumbered by descending count so the rows
+// the updates hit most sit together at the front of every table. Both
+// passes split the dataset across num_threads threads.
+typedef struct {
+    Experience* dataset;
+    int start;
+    int end;
+    atomic_int* counts;
+    const int* map;   // New ID of each state, for the relabelling pass
+} RenumberJob;
+
+typedef struct {
+    int count;
+    int state;
+} StateVisits;
+
+void* count_visits_thread(void* arg) {
+    RenumberJob* job = (RenumberJob*)arg;
+    for (int i = job->start; i < job->end; i++) {
+        atomic_fetch_add_explicit(&job->counts[job->dataset[i].state], 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&job->counts[job->dataset[i].next_state], 1, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+void* relabel_states_thread(void* arg) {
+    RenumberJob* job = (RenumberJob*)arg;
+    for (int i = job->start; i < job->end; i++) {
+        job->dataset[i].state = job->map[job->dataset[i].state];
+        job->dataset[i].next_state = job->map[job->dataset[i].next_state];
+    }
+    return NULL;
+}
+
+void run_renumber_jobs(void* (*func)(void*), Experience* dataset, int n, atomic_int* counts, const int* map) {
+    pthread_t threads[NUM_THREADS];
+    RenumberJob jobs[NUM_THREADS];
+    for (int t = 0; t < num_threads; t++) {
+        jobs[t] = (RenumberJob){ dataset, (int)((long)n * t / num_threads), (int)((long)n * (t + 1) / num_threads), counts, map };
+        pthread_create(&threads[t], NULL, func, &jobs[t]);
+    }
+    for (int t = 0; t < num_threads; t++)
+        pthread_join(threads[t], NULL);
+}
+
+// Most visits first, ties in original ID order so the numbering is the same
+// on every run over the same data (which --resume relies on)
+int compare_visits(const void* a, const void* b) {
+    const StateVisits* x = (const StateVisits*)a;
+    const StateVisits* y = (const StateVisits*)b;
+    if (x->count != y->count)
+        return x->count > y->count ? -1 : 1;
+    return (x->state > y->state) - (x->state < y->state);
+}
+
+// Renumber the dataset's states in place. Unvisited states get the IDs after
+// the visited ones, so their rows are never touched. States must already be
+// in range.
+int renumber_dataset(Experience* dataset, int n) {
+    atomic_int* counts = (atomic_int*)calloc(num_states, sizeof(atomic_int));
+    StateVisits* order = (StateVisits*)malloc(num_states * sizeof(StateVisits));
+    state_ids = (int*)malloc(num_states * sizeof(int));
+    state_ranks = (int*)malloc(num_states * sizeof(int));
+    if (counts == NULL || order == NULL || state_ids == NULL || state_ranks == NULL) {
+        perror("Error allocating memory for state renumbering");
+        free(counts);
+        free(order);
+        return 1;
+    }
+    run_renumber_jobs(count_visits_thread, dataset, n, counts, NULL);
+
+    visited_states = 0;
+    for (int state = 0; state < num_states; state++) {
+        int count = atomic_load_explicit(&counts[state], memory_order_relaxed);
+        if (count > 0)
+            order[visited_states++] = (StateVisits){ count, state };
+    }
+    qsort(order, visited_states, sizeof(StateVisits), compare_visits);
+    int next_id = visited_states;
+    for (int state = 0; state < num_states; state++) {
+        if (atomic_load_explicit(&counts[state], memory_order_relaxed) == 0)
+            order[next_id++] = (StateVisits){ 0, state };
+    }
+    for (int id = 0; id < num_states; id++) {
+        state_ids[id] = order[id].state;
+        state_ranks[order[id].state] = id;
+    }
+    run_renumber_jobs(relabel_states_thread, dataset, n, NULL, state_ranks);
+    free(counts);
+    free(order);
+    return 0;
+}
+
+// Move the rows of a renumbered table (row_doubles per state) back to their
+// original states
+int restore_state_order(double* table, size_t row_doubles) {
+    double* rows = (double*)malloc((size_t)num_states * row_doubles * sizeof(double));
+    if (rows == NULL) {
+        perror("Error allocating memory for state renumbering");
+        return 1;
+    }
+    memcpy(rows, table, (size_t)num_states * row_doubles * sizeof(double));
+    for (int id = 0; id < num_states; id++)
+        memcpy(table + (size_t)state_ids[id] * row_doubles, rows + (size_t)id * row_doubles, row_doubles * sizeof(double));
+    free(rows);
+    return 0;
+}
+
+// Action sets from a mask of valid (s,a) pairs: the CSR offsets and actions
+// of every row, in action order
+int build_action_sets(const unsigned char* valid) {
+    action_offsets = (int*)malloc((num_states + 1) * sizeof(int));
+    action_sets = (int*)malloc(((size_t)num_states * num_actions + 1) * sizeof(int));
+    if (action_offsets == NULL || action_sets == NULL) {
+        perror("Error allocating memory for action sets");
+        return 1;
+    }
+    int slots = 0;
+    for (int state = 0; state < num_states; state++) {
+        action_offsets[state] = slots;
+        for (int action = 0; action < num_actions; action++) {
+            if (valid[(size_t)state * num_actions + action])
+                action_sets[slots++] = action;
+        }
+    }
+    action_offsets[num_states] = slots;
+    return 0;
+}
+
+// Mask file: one line per state listing its actions, "<state> <action> ...";
+// '#' starts a comment and states without a line keep all actions. States
+// are original IDs; with --renumber, valid is indexed by the training IDs.
+int load_action_mask(const char* path, unsigned char* valid) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror("Error opening the action mask file");
+        return 1;
+    }
+    unsigned char* listed = (unsigned char*)calloc(num_states, 1);
+    if (listed == NULL) {
+        perror("Error allocating memory for action sets");
+        fclose(file);
+        return 1;
+    }
+    memset(valid, 1, (size_t)num_states * num_actions);
+    char line[4096];
+    int line_number = 0;
+    int status = 0;
+    while (status == 0 && fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char* p = line;
+        char* end;
+        long state = strtol(p, &end, 10);
+        if (end == p) {
+            while (*p == ' ' || *p == '\t')
+                p++;
+            if (*p != '#' && *p != '\n' && *p != '\r' && *p != '\0') {
+                fprintf(stderr, "%s:%d: expected <state> <action> ...\n", path, line_number);
+                status = 1;
+            }
+            continue;
+        }
+        if (state < 0 || state >= num_states) {
+            fprintf(stderr, "%s:%d: state %ld is outside the %d x %d table\n", path, line_number, state, num_states, num_actions);
+            status = 1;
+            continue;
+        }
+        if (state_ranks != NULL)
+            state = state_ranks[state];
+        // A state's first line replaces the default of all actions; more lines add to it
+        if (!listed[state])
+            memset(valid + state * num_actions, 0, num_actions);
+        listed[state] = 1;
+        for (p = end;; p = end) {
+            long action = strtol(p, &end, 10);
+            if (end == p)
+                break;
+            if (action < 0 || action >= num_actions) {
+                fprintf(stderr, "%s:%d: action %ld is outside the %d x %d table\n", path, line_number, action, num_states, num_actions);
+                status = 1;
+                break;
+            }
+            valid[state * num_actions + action] = 1;
+        }
+    }
+    free(listed);
+    fclose(file);
+    return status;
+}
+
+// Build the action sets (from the samples' own (s,a) pairs and logged
+// (s',a') pairs for --actions=DATA, else from the mask file) and rewrite
+// every action and next_action as its position in the state's row
+int index_dataset_actions(Experience* dataset, int n) {
+    unsigned char* valid = (unsigned char*)calloc((size_t)num_states * num_actions, 1);
+    int* positions = (int*)malloc((size_t)num_states * num_actions * sizeof(int));
+    if (valid == NULL || positions == NULL) {
+        perror("Error allocating memory for action sets");
+        free(valid);
+        free(positions);
+        return 1;
+    }
+    int status = 0;
+    if (strcmp(actions_source, "DATA") == 0) {
+        for (int i = 0; i < n; i++) {
+            valid[(size_t)dataset[i].state * num_actions + dataset[i].action] = 1;
+            if (dataset[i].next_action >= 0)
+                valid[(size_t)dataset[i].next_state * num_actions + dataset[i].next_action] = 1;
+        }
+    } else {
+        status = load_action_mask(actions_source, valid);
+    }
+    if (status == 0)
+        status = build_action_sets(valid);
+
+    for (int state = 0; status == 0 && state < num_states; state++) {
+        for (int action = 0; action < num_actions; action++)
+            positions[(size_t)state * num_actions + action] = -1;
+        for (int slot = action_offsets[state]; slot < action_offsets[state + 1]; slot++)
+            positions[(size_t)state * num_actions + action_sets[slot]] = slot - action_offsets[state];
+    }
+    for (int i = 0; status == 0 && i < n; i++) {
+        Experience* e = &dataset[i];
+        int position = positions[(size_t)e->state * num_actions + e->action];
+        int next_position = e->next_action >= 0 ? positions[(size_t)e->next_state * num_actions + e->next_action] : -1;
+        if (position < 0 || (e->next_action >= 0 && next_position < 0)) {
+            fprintf(stderr, "Sample %d takes an action outside the action set of its state\n", i);
+            status = 1;
+            break;
+        }
+        e->action = position;
+        e->next_action = next_position;
+    }
+    free(valid);
+    free(positions);
+    return status;
+}
+
+// Undo index_dataset_actions
+void restore_dataset_actions(Experience* dataset, int n) {
+    for (int i = 0; i < n; i++) {
+        Experience* e = &dataset[i];
+        e->action = action_sets[action_offsets[e->state] + e->action];
+        if (e->next_action >= 0)
+            e->next_action = action_sets[action_offsets[e->next_state] + e->next_action];
+    }
+}
+
+// Spread a ragged table over the rows of a dense one; actions outside a
+// state's set read as 0, like an action a dense table never updated
+void expand_ragged_table(const double* ragged, double (*q_table)[NUM_ACTIONS]) {
+    for (int state = 0; state < num_states; state++) {
+        for (int action = 0; action < num_actions; action++)
+            q_table[state][action] = 0.0;
+        for (int slot = action_offsets[state]; slot < action_offsets[state + 1]; slot++)
+            q_table[state][action_sets[slot]] = ragged[slot];
+    }
+}
+
+
+// Empirical MDP in CSR form. Row r = s * num_actions + a holds the observed
+// successors of (s,a) with their empirical probabilities.
+typedef struct {
+    int num_rows;
+    int* row_offsets;   // num_rows + 1 offsets into next_states / probs
+    int* next_states;
+    double* probs;
+    double* rewards;    // Mean reward per row
+    double* next_rewards;  // Mean reward per successor, for sampling the model in --evaluate
+    int* visits;        // Samples per row, 0 for pairs never seen in the dataset
+} EmpiricalModel;
+
+typedef struct {
+    EmpiricalModel* model;
+    double (*q_table)[NUM_ACTIONS];
+    double* values;      // max(0, max_a Q(s,a)) from the previous sweep
+    int start_state;
+    int end_state;
+    double residual;     // Largest |dQ| this thread produced in the current sweep
+} ModelThreadData;
+
+pthread_barrier_t sweep_barrier;
+ModelThreadData* all_model_data;
+int model_stop = 0;
+int model_sweeps = 0;
+double model_residual = 0.0;
+
+void free_empirical_model(EmpiricalModel* model) {
+    free(model->row_offsets);
+    free(model->next_states);
+    free(model->probs);
+    free(model->rewards);
+    free(model->next_rewards);
+    free(model->visits);
+}
+
+// Fills the model's arrays from the samples, using build_empirical_model's
+// scratch arrays
+int fill_empirical_model(Experience* dataset, int n, EmpiricalModel* model, int* order, int* cursor, int* last_row,
+                         int* position) {
+    int num_rows = model->num_rows;
+
+    // Visit counts and reward sums per (s,a)
+    for (int i = 0; i < n; i++) {
+        Experience e = dataset[i];
+        if (e.state < 0 || e.state >= num_states || e.next_state < 0 || e.next_state >= num_states ||
+            e.action < 0 || e.action >= num_actions) {
+            fprintf(stderr, "Sample %d is outside the %d x %d table\n", i, num_states, num_actions);
+            return 1;
+        }
+        int row = e.state * num_actions + e.action;
+        model->visits[row]++;
+        model->rewards[row] += e.reward;
+    }
+
+    // Counting sort of the samples by row
+    cursor[0] = 0;
+    for (int row = 0; row < num_rows; row++)
+        cursor[row + 1] = cursor[row] + model->visits[row];
+    for (int i = 0; i < n; i++) {
+        int row = dataset[i].state * num_actions + dataset[i].action;
+        order[cursor[row]++] = i;
+    }
+
+    // Merge duplicate successors within each row
+    for (int s = 0; s < num_states; s++)
+        last_row[s] = -1;
+    int nnz = 0, begin = 0;
+    for (int row = 0; row < num_rows; row++) {
+        model->row_offsets[row] = nnz;
+        int end = begin + model->visits[row];
+        for (int k = begin; k < end; k++) {
+            int next_s = dataset[order[k]].next_state;
+            if (last_row[next_s] != row) {
+                last_row[next_s] = row;
+                position[next_s] = nnz;
+                model->next_states[nnz] = next_s;
+                model->probs[nnz] = 0.0;
+                model->next_rewards[nnz] = 0.0;
+                nnz++;
+            }
+            model->probs[position[next_s]] += 1.0;
+            model->next_rewards[position[next_s]] += dataset[order[k]].reward;
+        }
+        if (model->visits[row] > 0) {
+            for (int k = model->row_offsets[row]; k < nnz; k++) {
+                model->next_rewards[k] /= model->probs[k];
+                model->probs[k] /= model->visits[row];
+            }
+            model->rewards[row] /= model->visits[row];
+        }
+        begin = end;
+    }
+    model->row_offsets[num_rows] = nnz;
+    return 0;
+}
+
+// CSR model of the samples. On failure nothing stays allocated.
+int build_empirical_model(Experience* dataset, int n, EmpiricalModel* model) {
+    int num_rows = num_states * num_actions;
+    model->num_rows = num_rows;
+    model->row_offsets = (int*)calloc(num_rows + 1, sizeof(int));
+    model->next_states = (int*)malloc((n > 0 ? n : 1) * sizeof(int));
+    model->probs = (double*)malloc((n > 0 ? n : 1) * sizeof(double));
+    model->rewards = (double*)calloc(num_rows, sizeof(double));
+    model->next_rewards = (double*)malloc((n > 0 ? n : 1) * sizeof(double));
+    model->visits = (int*)calloc(num_rows, sizeof(int));
+    int* order = (int*)malloc((n > 0 ? n : 1) * sizeof(int));
+    int* cursor = (int*)malloc((num_rows + 1) * sizeof(int));
+    int* last_row = (int*)malloc(num_states * sizeof(int));
+    int* position = (int*)malloc(num_states * sizeof(int));
+    int status;
+    if (model->row_offsets == NULL || model->next_states == NULL || model->probs == NULL ||
+        model->rewards == NULL || model->next_rewards == NULL || model->visits == NULL || order == NULL || cursor == NULL ||
+        last_row == NULL || position == NULL) {
+        perror("Error allocating memory for the empirical model");
+        status = 1;
+    } else {
+        status = fill_empirical_model(dataset, n, model, order, cursor, last_row, position);
+    }
+
+    free(order);
+    free(cursor);
+    free(last_row);
+    free(position);
+    if (status != 0)
+        free_empirical_model(model);
+    return status;
+}
+
+// Jacobi value iteration over the states owned by this thread. The state
+// value uses the same max(0, max_a Q) as update_q_table, so the result is the
+// fixed point the sample-based learner is converging towards.
+void* value_iteration_thread(void* thread_data) {
+    ModelThreadData* data = (ModelThreadData*)thread_data;
+    EmpiricalModel* model = data->model;
+    double (*q_table)[NUM_ACTIONS] = data->q_table;
+    double tol = convergence_tol > 0 ? convergence_tol : VALUE_ITERATION_TOL;
+
+    for (int sweep = 0; sweep < num_episodes; sweep++) {
+        for (int s = data->start_state; s < data->end_state; s++) {
+            double best = 0;
+            for (int a = 0; a < num_actions; a++)
+                best = q_table[s][a] > best ? q_table[s][a] : best;
+            data->values[s] = best;
+        }
+        pthread_barrier_wait(&sweep_barrier);
+
+        double residual = 0.0;
+        for (int s = data->start_state; s < data->end_state; s++) {
+            for (int a = 0; a < num_actions; a++) {
+                int row = s * num_actions + a;
+                if (model->visits[row] == 0)
+                    continue;
+                double expected = 0.0;
+                for (int k = model->row_offsets[row]; k < model->row_offsets[row + 1]; k++)
+                    expected += model->probs[k] * data->values[model->next_states[k]];
+                double q_new = model->rewards[row] + GAMMA * expected;
+                double diff = q_new - q_table[s][a];
+                if (diff < 0)
+                    diff = -diff;
+                if (diff > residual)
+                    residual = diff;
+                q_table[s][a] = q_new;
+            }
+        }
+        data->residual = residual;
+
+        if (pthread_barrier_wait(&sweep_barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+            double max = 0.0;
+            for (int t = 0; t < num_threads; t++)
+                if (all_model_data[t].residual > max)
+                    max = all_model_data[t].residual;
+            model_residual = max;
+            model_sweeps = sweep + 1;
+            if (max < tol)
+                model_stop = 1;
+        }
+        pthread_barrier_wait(&sweep_barrier);
+        if (model_stop)
+            break;
+    }
+
+    pthread_exit(NULL);
+}
+
+// printf("%f") without the format parsing: x is rounded to 6 decimals
+// (half to even) exactly from the bits of the double, so the text matches
+// printf byte for byte. NaN, infinities and |x| >= 2^33 go through sprintf.
+char* format_fixed6(char* p, double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int biased = (int)((bits >> 52) & 0x7ff);
+    if (biased >= 1023 + 33)
+        return p + sprintf(p, "%f", x);
+    if (bits >> 63)
+        *p++ = '-';
+
+    // |x| = mant * 2^exp with exp <= -20, so |x| * 1e6 = scaled >> -exp
+    uint64_t mant = bits & ((UINT64_C(1) << 52) - 1);
+    int exp = -1074;
+    if (biased != 0) {
+        mant |= UINT64_C(1) << 52;
+        exp = biased - 1075;
+    }
+    uint64_t n = 0;
+    if (exp >= -126) {
+        int shift = -exp;
+        unsigned __int128 scaled = (unsigned __int128)mant * 1000000;
+        unsigned __int128 rem = scaled & (((unsigned __int128)1 << shift) - 1);
+        unsigned __int128 half = (unsigned __int128)1 << (shift - 1);
+        n = (uint64_t)(scaled >> shift);
+        if (rem > half || (rem == half && (n & 1)))
+            n++;
+    }
+
+    char digits[24];
+    int len = 0;
+    uint64_t whole = n / 1000000;
+    do {
+        digits[len++] = (char)('0' + whole % 10);
+        whole /= 10;
+    } while (whole > 0);
+    while (len > 0)
+        *p++ = digits[--len];
+    *p++ = '.';
+    uint32_t frac = (uint32_t)(n % 1000000);
+    for (int i = 5; i >= 0; i--) {
+        p[i] = (char)('0' + frac % 10);
+        frac /= 10;
+    }
+    return p + 6;
+}
+
+// Q(s, a) lives at q[s * row_stride + a * col_stride], which covers the
+// per-thread tables, the SWEEP tables and the compact merged table. Row i is
+// labelled states[i] (the rows of a --table=HASH table), or state i when
+// states is NULL.
+void print_q_rows(const double* q, size_t row_stride, size_t col_stride, const int* states, int count) {
+    char buffer[OUTPUT_BUFFER_SIZE];
+    char* p = buffer;
+    for (int row = 0; row < count; row++) {
+        int state = states != NULL ? states[row] : row;
+        for (int action = 0; action < num_actions; action++) {
+            if (p - buffer > OUTPUT_BUFFER_SIZE - 512) {
+                fwrite(buffer, 1, p - buffer, stdout);
+                p = buffer;
+            }
+            memcpy(p, "Q(", 2);
+            p = qformat_int(p + 2, state);
+            memcpy(p, ", ", 2);
+            p = qformat_int(p + 2, action);
+            memcpy(p, ") = ", 4);
+            p = format_fixed6(p + 4, q[row * row_stride + action * col_stride]);
+            *p++ = '\n';
+        }
+    }
+    fwrite(buffer, 1, p - buffer, stdout);
+}
+
+// One line per state: the greedy action (lowest index on ties) and its value
+void print_greedy_policy(const double* q, size_t row_stride, size_t col_stride, const int* states, int count) {
+    char buffer[OUTPUT_BUFFER_SIZE];
+    char* p = buffer;
+    for (int row = 0; row < count; row++) {
+        if (p - buffer > OUTPUT_BUFFER_SIZE - 512) {
+            fwrite(buffer, 1, p - buffer, stdout);
+            p = buffer;
+        }
+        int best = 0;
+        for (int action = 1; action < num_actions; action++) {
+            if (q[row * row_stride + action * col_stride] > q[row * row_stride + best * col_stride])
+                best = action;
+        }
+        memcpy(p, "pi(", 3);
+        p = qformat_int(p + 3, states != NULL ? states[row] : row);
+        memcpy(p, ") = ", 4);
+        p = qformat_int(p + 4, best);
+        memcpy(p, ", Q = ", 6);
+        p = format_fixed6(p + 6, q[row * row_stride + best * col_stride]);
+        *p++ = '\n';
+    }
+    fwrite(buffer, 1, p - buffer, stdout);
+}
+
+// Single-table engines (MODEL, PSWEEP): ALL and MERGED print the same table
+void print_q_table(const char* title, double (*q_table)[NUM_ACTIONS]) {
+    if (print_type == PRINT_NONE)
+        return;
+    if (print_type == PRINT_GREEDY) {
+        printf("Greedy policy from %s:\n", title);
+        print_greedy_policy(&q_table[0][0], NUM_ACTIONS, 1, NULL, num_states);
+    } else {
+        printf("%s:\n", title);
+        print_q_rows(&q_table[0][0], NUM_ACTIONS, 1, NULL, num_states);
+    }
+    printf("\n");
+}
+
+// Checkpoint header and payload in one zeroed allocation, written with a
+// single write(); tables are filled in place through qtable_data()
+QTableHeader* new_checkpoint(int threads, int configs, int merged) {
+    uint32_t num_tables = (uint32_t)(configs * (threads + (merged ? 1 : 0)));
+    size_t bytes = sizeof(QTableHeader) + (size_t)num_tables * num_states * num_actions * sizeof(double);
+    QTableHeader* header = (QTableHeader*)calloc(1, bytes);
+    if (header == NULL) {
+        perror("Error allocating memory for checkpoint");
+        return NULL;
+    }
+    memcpy(header->magic, QTABLE_MAGIC, sizeof(header->magic));
+    header->version = QTABLE_VERSION;
+    header->header_size = sizeof(QTableHeader);
+    header->value_size = sizeof(double);
+    header->num_states = (uint32_t)num_states;
+    header->num_actions = (uint32_t)num_actions;
+    header->num_threads = (uint32_t)threads;
+    header->num_configs = (uint32_t)configs;
+    header->num_tables = num_tables;
+    header->flags = merged ? QTABLE_HAS_MERGED : 0;
+    return header;
+}
+
+int write_file(const char* path, const void* data, size_t bytes) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    const char* p = (const char*)data;
+    while (bytes > 0) {
+        ssize_t written = write(fd, p, bytes);
+        if (written < 0) {
+            perror(path);
+            close(fd);
+            return 1;
+        }
+        p += written;
+        bytes -= (size_t)written;
+    }
+    if (close(fd) != 0) {
+        perror(path);
+        return 1;
+    }
+    return 0;
+}
+
+QPolicyHeader* new_policy(int policies) {
+    uint32_t action_size = num_actions <= 256 ? 1 : 2;
+    uint64_t stride = ((uint64_t)num_states * action_size + 4 + 63) / 64 * 64;
+    QPolicyHeader* header = (QPolicyHeader*)calloc(1, sizeof(QPolicyHeader) + policies * stride);
+    if (header == NULL) {
+        perror("Error allocating memory for policy");
+        return NULL;
+    }
+    memcpy(header->magic, QPOLICY_MAGIC, sizeof(header->magic));
+    header->version = QPOLICY_VERSION;
+    header->header_size = sizeof(QPolicyHeader);
+    header->num_states = (uint32_t)num_states;
+    header->num_actions = (uint32_t)num_actions;
+    header->action_size = action_size;
+    header->num_policies = (uint32_t)policies;
+    header->policy_stride = stride;
+    return header;
+}
+
+typedef struct {
+    const double* q;
+    size_t row_stride;
+    int start_state;
+    int end_state;
+    QPolicyHeader* policy;
+    int index;
+} PolicyJob;
+
+void* extract_policy_thread(void* arg) {
+    PolicyJob* job = (PolicyJob*)arg;
+    qpolicy_extract(job->q, job->row_stride, num_actions, job->start_state, job->end_state, job->policy->action_size,
+                    qpolicy_actions(job->policy, job->index));
+    return NULL;
+}
+
+// Greedy actions of a merged table into array index of policy, with the
+// states split over num_threads threads in whole SIMD blocks of 4
+void extract_policy(const double* q, size_t row_stride, QPolicyHeader* policy, int index) {
+    pthread_t threads[NUM_THREADS];
+    PolicyJob jobs[NUM_THREADS];
+    int block = ((num_states + num_threads - 1) / num_threads + 3) / 4 * 4;
+    int n = 0;
+    for (int start = 0; start < num_states; start += block) {
+        jobs[n].q = q;
+        jobs[n].row_stride = row_stride;
+        jobs[n].start_state = start;
+        jobs[n].end_state = start + block < num_states ? start + block : num_states;
+        jobs[n].policy = policy;
+        jobs[n].index = index;
+        pthread_create(&threads[n], NULL, extract_policy_thread, &jobs[n]);
+        n++;
+    }
+    for (int t = 0; t < n; t++)
+        pthread_join(threads[t], NULL);
+}
+
+int write_policy(const char* path, const QPolicyHeader* header) {
+    return write_file(path, header, header->header_size + header->num_policies * header->policy_stride);
+}
+
+int write_checkpoint(const char* path, const QTableHeader* header) {
+    size_t bytes = header->header_size + (size_t)header->num_tables * header->num_states * header->num_actions * sizeof(double);
+    return write_file(path, header, bytes);
+}
+
+// Background writer for the training state snapshots. Each round goes to
+// <path>.tmp and is renamed over <path>, so a pre-empted job always leaves
+// the last complete snapshot behind.
+void* snapshot_writer_thread(void* arg) {
+    (void)arg;
+    size_t len = strlen(state_path);
+    char* tmp_path = (char*)malloc(len + 5);
+    if (tmp_path == NULL) {
+        perror("Error allocating memory for snapshot path");
+        return NULL;
+    }
+    memcpy(tmp_path, state_path, len);
+    memcpy(tmp_path + len, ".tmp", 5);
+
+    pthread_mutex_lock(&snapshot_lock);
+    for (;;) {
+        Snapshot* snap = NULL;
+        for (int b = 0; b < 2; b++) {
+            if (snapshots[b].ready && (snap == NULL || snapshots[b].round < snap->round))
+                snap = &snapshots[b];
+        }
+        if (snap == NULL) {
+            if (snapshot_shutdown)
+                break;
+            pthread_cond_wait(&snapshot_cond, &snapshot_lock);
+            continue;
+        }
+        snap->ready = 0;
+        pthread_mutex_unlock(&snapshot_lock);
+
+        if (write_file(tmp_path, snap->header, snap->bytes) == 0 && rename(tmp_path, state_path) != 0)
+            perror("Error renaming snapshot");
+
+        pthread_mutex_lock(&snapshot_lock);
+        snap->round = -1;
+        pthread_cond_broadcast(&snapshot_cond);
+    }
+    pthread_mutex_unlock(&snapshot_lock);
+    free(tmp_path);
+    return NULL;
+}
+
+// Header for this run's snapshots; --resume compares it field by field with
+// the header on disk
+void init_state_header(QStateHeader* header, int num_samples) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, QSTATE_MAGIC, sizeof(header->magic));
+    header->version = QSTATE_VERSION;
+    header->header_size = sizeof(QStateHeader);
+    header->num_states = (uint32_t)num_states;
+    header->num_actions = (uint32_t)num_actions;
+    header->num_threads = (uint32_t)num_threads;
+    header->num_samples = (uint32_t)num_samples;
+    header->sampling = (uint32_t)sampling_type;
+    header->algorithm = (uint32_t)algorithm_type;
+    header->update = (uint32_t)update_type;
+    header->engine = (uint32_t)engine_type;
+    header->config_stride = engine_type == SWEEP ? (uint32_t)config_stride : 0;
+    header->table_doubles = (uint64_t)num_states * NUM_ACTIONS * (engine_type == SWEEP ? config_stride : 1);
+    header->prev_doubles = convergence_tol > 0 ? (uint64_t)num_states * NUM_ACTIONS : 0;
+    header->record_size = (uint32_t)(sizeof(QStateThread) + (header->table_doubles + header->prev_doubles) * sizeof(double));
+    header->episode = -1;
+}
+
+int start_snapshots(int num_samples, pthread_t* writer) {
+    for (int b = 0; b < 2; b++) {
+        QStateHeader header;
+        init_state_header(&header, num_samples);
+        snapshots[b].bytes = header.header_size + (size_t)num_threads * header.record_size;
+        snapshots[b].header = (QStateHeader*)malloc(snapshots[b].bytes);
+        if (snapshots[b].header == NULL) {
+            perror("Error allocating memory for snapshots");
+            return 1;
+        }
+        *snapshots[b].header = header;
+        snapshots[b].round = -1;
+        snapshots[b].deposited = 0;
+        snapshots[b].ready = 0;
+    }
+    snapshot_shutdown = 0;
+    pthread_create(writer, NULL, snapshot_writer_thread, NULL);
+    return 0;
+}
+
+// Wait for the writer to drain the completed rounds
+void stop_snapshots(pthread_t writer) {
+    pthread_mutex_lock(&snapshot_lock);
+    snapshot_shutdown = 1;
+    pthread_cond_broadcast(&snapshot_cond);
+    pthread_mutex_unlock(&snapshot_lock);
+    pthread_join(writer, NULL);
+    for (int b = 0; b < 2; b++)
+        free(snapshots[b].header);
+}
+
+// Create and map the --stats page; the magic goes in last so a reader never
+// sees a half-written header
+int open_stats_page(int num_samples) {
+    int fd = open(stats_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(stats_path);
+        return 1;
+    }
+    stats_bytes = sizeof(QStatsHeader) + (size_t)num_threads * sizeof(QStatsThread);
+    if (ftruncate(fd, stats_bytes) != 0) {
+        perror(stats_path);
+        close(fd);
+        return 1;
+    }
+    stats_page = mmap(NULL, stats_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stats_page == MAP_FAILED) {
+        stats_page = NULL;
+        perror(stats_path);
+        return 1;
+    }
+    stats_page->version = QSTATS_VERSION;
+    stats_page->header_size = sizeof(QStatsHeader);
+    stats_page->record_size = sizeof(QStatsThread);
+    stats_page->num_threads = num_threads;
+    stats_page->num_episodes = num_episodes;
+    stats_page->pid = getpid();
+    stats_page->start_ns = monotonic_ns();
+    stats_page->num_samples = num_samples;
+    stats_page->flags = convergence_tol > 0 ? QSTATS_HAS_DELTA : 0;
+    stats_page->episodes_run = 0;
+    atomic_thread_fence(memory_order_release);
+    memcpy(stats_page->magic, QSTATS_MAGIC, sizeof(stats_page->magic));
+    return 0;
+}
+
+void init_thread_stats(ThreadData* data) {
+    data->stats = NULL;
+    if (stats_page == NULL)
+        return;
+    data->stats = qstats_thread(stats_page, data->thread_id);
+    data->stats->episode = data->start_episode;
+    data->stats->samples_per_episode = data->pass_samples;
+    data->stats->updated_ns = stats_page->start_ns;
+}
+
+// The page stays behind with the final numbers for whoever polls it last
+void close_stats_page(void) {
+    atomic_store(&stats_page->status, QSTATS_DONE);
+    munmap(stats_page, stats_bytes);
+    stats_page = NULL;
+}
+
+// Create and map the --publish page, and the two staging rounds
+int open_publish_page(void) {
+    uint32_t num_tables = engine_type == SWEEP ? num_configs : 1;
+    size_t slot_size = sizeof(QPublishSlot) + (size_t)num_tables * num_states * num_actions * sizeof(double);
+    slot_size = (slot_size + 63) / 64 * 64;
+    publish_doubles = (size_t)num_states * NUM_ACTIONS * (engine_type == SWEEP ? config_stride : 1);
+    for (int r = 0; r < 2; r++) {
+        publish_rounds[r].tables = (double*)malloc((size_t)num_threads * publish_doubles * sizeof(double));
+        if (publish_rounds[r].tables == NULL) {
+            perror("Error allocating memory for table publishing");
+            return 1;
+        }
+        publish_rounds[r].round = -1;
+        publish_rounds[r].deposited = 0;
+    }
+
+    int fd = open(publish_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(publish_path);
+        return 1;
+    }
+    publish_bytes = sizeof(QPublishHeader) + 2 * slot_size;
+    if (ftruncate(fd, publish_bytes) != 0) {
+        perror(publish_path);
+        close(fd);
+        return 1;
+    }
+    publish_page = mmap(NULL, publish_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (publish_page == MAP_FAILED) {
+        publish_page = NULL;
+        perror(publish_path);
+        return 1;
+    }
+    publish_page->version = QPUB_VERSION;
+    publish_page->header_size = sizeof(QPublishHeader);
+    publish_page->num_states = num_states;
+    publish_page->num_actions = num_actions;
+    publish_page->num_tables = num_tables;
+    publish_page->pid = getpid();
+    publish_page->slot_size = slot_size;
+    atomic_thread_fence(memory_order_release);
+    memcpy(publish_page->magic, QPUB_MAGIC, sizeof(publish_page->magic));
+    return 0;
+}
+
+// The final tables stay in the file for readers that come later
+void close_publish_page(void) {
+    atomic_store(&publish_page->status, QSTATS_DONE);
+    munmap(publish_page, publish_bytes);
+    publish_page = NULL;
+    for (int r = 0; r < 2; r++)
+        free(publish_rounds[r].tables);
+}
+
+// Read --state-file for --resume; the file must come from the same command line
+QStateHeader* load_training_state(int num_samples) {
+    FILE* file = fopen(state_path, "rb");
+    if (file == NULL) {
+        perror(state_path);
+        return NULL;
+    }
+    QStateHeader expected, header;
+    init_state_header(&expected, num_samples);
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, QSTATE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != QSTATE_VERSION) {
+        fprintf(stderr, "%s is not a training state file\n", state_path);
+        fclose(file);
+        return NULL;
+    }
+    if (header.header_size != expected.header_size || header.record_size != expected.record_size ||
+        header.num_states != expected.num_states || header.num_actions != expected.num_actions ||
+        header.num_threads != expected.num_threads || header.num_samples != expected.num_samples ||
+        header.sampling != expected.sampling || header.algorithm != expected.algorithm ||
+        header.update != expected.update || header.engine != expected.engine ||
+        header.config_stride != expected.config_stride || header.prev_doubles != expected.prev_doubles) {
+        fprintf(stderr, "%s was written by a run with different settings\n", state_path);
+        fclose(file);
+        return NULL;
+    }
+
+    size_t bytes = header.header_size + (size_t)num_threads * header.record_size;
+    QStateHeader* state = (QStateHeader*)malloc(bytes);
+    if (state == NULL) {
+        perror("Error allocating memory for training state");
+        fclose(file);
+        return NULL;
+    }
+    *state = header;
+    if (fread((char*)state + header.header_size, header.record_size, num_threads, file) != (size_t)num_threads) {
+        fprintf(stderr, "%s is truncated\n", state_path);
+        free(state);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    return state;
+}
+
+void restore_thread_state(const QStateHeader* state, ThreadData* data) {
+    const char* record = (const char*)state + state->header_size + (size_t)data->thread_id * state->record_size;
+    const QStateThread* thread_state = (const QStateThread*)record;
+    data->seed = thread_state->seed;
+    data->rand_seed = thread_state->rand_seed;
+    data->converged_streak = thread_state->converged_streak;
+    data->converged_episode = thread_state->converged_episode;
+    data->start_episode = state->episode + 1;
+    const double* table = (const double*)(record + sizeof(QStateThread));
+    if (data->sweep_table != NULL)
+        memcpy(data->sweep_table, table, state->table_doubles * sizeof(double));
+    else
+        memcpy(data->q_table, table, state->table_doubles * sizeof(double));
+    if (state->prev_doubles > 0)
+        memcpy(data->prev_q_table, table + state->table_doubles, state->prev_doubles * sizeof(double));
+}
+
+// Checkpoint for the single-table engines
+int save_single_checkpoint(double (*q_table)[NUM_ACTIONS]) {
+    if (checkpoint_path == NULL)
+        return 0;
+    QTableHeader* header = new_checkpoint(1, 1, 0);
+    if (header == NULL)
+        return 1;
+    double* out = qtable_data(header);
+    for (int state = 0; state < num_states; state++)
+        memcpy(out + (size_t)state * num_actions, q_table[state], num_actions * sizeof(double));
+    int status = write_checkpoint(checkpoint_path, header);
+    free(header);
+    return status;
+}
+
+// Greedy policy of a single-table engine for --policy, handed back in
+// *policy when --evaluate still needs it
+int save_single_policy(double (*q_table)[NUM_ACTIONS], QPolicyHeader** policy) {
+    *policy = NULL;
+    if (policy_path == NULL && eval_episodes == 0)
+        return 0;
+    *policy = new_policy(1);
+    if (*policy == NULL)
+        return 1;
+    extract_policy(&q_table[0][0], NUM_ACTIONS, *policy, 0);
+    int status = policy_path != NULL ? write_policy(policy_path, *policy) : 0;
+    if (status != 0 || eval_episodes == 0) {
+        free(*policy);
+        *policy = NULL;
+    }
+    return status;
+}
+
+// Report one configuration's n per-thread tables (tables[i][s * row_stride +
+// a * col_stride]) as selected by --print. If payload is non-NULL it
+// receives the n tables and their mean, compacted to num_actions columns;
+// if policy is non-NULL, array config of it receives the mean's greedy actions.
+int report_q_tables(const char* label, const double* tables[], int n, size_t row_stride, size_t col_stride, double* payload,
+                    QPolicyHeader* policy, int config) {
+    size_t cells = (size_t)num_states * num_actions;
+
+    if (print_type == PRINT_ALL) {
+        for (int i = 0; i < n; i++) {
+            if (label[0] != '\0')
+                printf("Q-table for %s, Thread %d:\n", label, i);
+            else
+                printf("Q-table for Thread %d:\n", i);
+            print_q_rows(tables[i], row_stride, col_stride, NULL, num_states);
+            printf("\n");
+        }
+    }
+    if (payload == NULL && policy == NULL && (print_type == PRINT_ALL || print_type == PRINT_NONE))
+        return 0;
+
+    struct timespec merge_start;
+    clock_gettime(CLOCK_MONOTONIC, &merge_start);
+    uint64_t trace_start = trace_begin(&main_trace);
+    double* merged = payload != NULL ? payload + n * cells : (double*)malloc(cells * sizeof(double));
+    if (merged == NULL) {
+        perror("Error allocating memory for merged Q-table");
+        return 1;
+    }
+    for (int state = 0; state < num_states; state++) {
+        for (int action = 0; action < num_actions; action++) {
+            double sum = 0.0;
+            for (int i = 0; i < n; i++) {
+                double q = tables[i][state * row_stride + action * col_stride];
+                if (payload != NULL)
+                    payload[i * cells + (size_t)state * num_actions + action] = q;
+                sum += q;
+            }
+            merged[(size_t)state * num_actions + action] = sum / n;
+        }
+    }
+    if (policy != NULL)
+        extract_policy(merged, num_actions, policy, config);
+    phase_seconds[PHASE_MERGE] += seconds_since(merge_start);
+    trace_end(&main_trace, PHASE_MERGE, trace_start, -1);
+
+    const char* sep = label[0] != '\0' ? ", " : "";
+    if (print_type == PRINT_MERGED) {
+        printf("Merged Q-table for %s%sall %d threads:\n", label, sep, n);
+        print_q_rows(merged, num_actions, 1, NULL, num_states);
+        printf("\n");
+    } else if (print_type == PRINT_GREEDY) {
+        printf("Greedy policy for %s%sall %d threads:\n", label, sep, n);
+        print_greedy_policy(merged, num_actions, 1, NULL, num_states);
+        printf("\n");
+    }
+    if (payload == NULL)
+        free(merged);
+    return 0;
+}
+
+int compare_ints(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// Distinct states among the samples a thread visits, which is the number of
+// rows its sparse table ends up with. seen is a zeroed bitmap over
+// num_states and is left zeroed.
+long count_thread_states(const ThreadData* data, uint64_t* seen) {
+    int first = data->start_index, end = data->end_index;
+    if (sampling_type == STRIDE) {
+        // STRIDE threads walk the dataset from index 0, whatever their chunk
+        first = 0;
+        end = (data->end_index - data->start_index) / NUM_STRIDE * NUM_STRIDE;
+    }
+    long count = 0;
+    for (int i = first; i < end; i++) {
+        int state = data->dataset[i].state;
+        uint64_t bit = 1ull << (state % 64);
+        count += (seen[state / 64] & bit) == 0;
+        seen[state / 64] |= bit;
+    }
+    for (int i = first; i < end; i++)
+        seen[data->dataset[i].state / 64] = 0;
+    return count;
+}
+
+// Rows of a sparse table in (original) state order, copied out as a compact table:
+// states[i] and its values at rows[i * num_actions]. Returns the row count,
+// or -1 when out of memory.
+int sorted_hash_rows(const QHash* table, int** states, double** rows) {
+    int count = 0;
+    *states = (int*)malloc((atomic_load(&table->size) + 1) * sizeof(int));
+    if (*states == NULL) {
+        perror("Error allocating memory for sparse Q-table rows");
+        return -1;
+    }
+    for (size_t slot = 0; slot < qhash_slots(table); slot++) {
+        int32_t state = qhash_key(table, slot);
+        if (state != QHASH_EMPTY)
+            (*states)[count++] = state_ids != NULL ? state_ids[state] : state;
+    }
+    qsort(*states, count, sizeof(int), compare_ints);
+    *rows = (double*)malloc(((size_t)count * num_actions + 1) * sizeof(double));
+    if (*rows == NULL) {
+        perror("Error allocating memory for sparse Q-table rows");
+        free(*states);
+        return -1;
+    }
+    for (int i = 0; i < count; i++)
+        memcpy(*rows + (size_t)i * num_actions, qhash_find(table, state_ranks != NULL ? state_ranks[(*states)[i]] : (*states)[i]),
+               num_actions * sizeof(double));
+    return count;
+}
+
+// Merging the --table=HASH tables: each thread inserts the states of its own
+// table into the shared merged table, then, once all have joined, averages
+// its share of the merged slots (and takes their greedy actions)
+typedef struct {
+    const QHash* tables;
+    int n;
+    QHash* merged;
+    int thread;
+    QPolicyHeader* policy;
+} HashMergeJob;
+
+void* merge_hash_states_thread(void* arg) {
+    HashMergeJob* job = (HashMergeJob*)arg;
+    const QHash* table = &job->tables[job->thread];
+    for (size_t slot = 0; slot < qhash_slots(table); slot++) {
+        int32_t state = qhash_key(table, slot);
+        if (state != QHASH_EMPTY)
+            qhash_insert_concurrent(job->merged, state);
+    }
+    return NULL;
+}
+
+void* merge_hash_rows_thread(void* arg) {
+    HashMergeJob* job = (HashMergeJob*)arg;
+    size_t slots = qhash_slots(job->merged);
+    size_t end = slots * (job->thread + 1) / job->n;
+    for (size_t slot = slots * job->thread / job->n; slot < end; slot++) {
+        int32_t state = qhash_key(job->merged, slot);
+        if (state == QHASH_EMPTY)
+            continue;
+        double* row = qhash_row(job->merged, slot);
+        // Same summation order as the dense merge, so both give the same bits
+        for (int action = 0; action < num_actions; action++) {
+            double sum = 0.0;
+            for (int i = 0; i < job->n; i++)
+                sum += qhash_find(&job->tables[i], state)[action];
+            row[action] = sum / job->n;
+        }
+        if (job->policy != NULL) {
+            int best = 0;
+            for (int action = 1; action < num_actions; action++) {
+                if (row[action] > row[best])
+                    best = action;
+            }
+            qpolicy_store(qpolicy_actions(job->policy, 0), job->policy->action_size,
+                          state_ids != NULL ? state_ids[state] : state, best);
+        }
+    }
+    return NULL;
+}
+
+// report_q_tables for --table=HASH. Only states with a row are printed;
+// every other state is all zeros, with greedy action 0 in the policy.
+int report_hash_tables(const QHash tables[], int n, QPolicyHeader* policy) {
+    int* states;
+    double* rows;
+    if (print_type == PRINT_ALL) {
+        for (int i = 0; i < n; i++) {
+            int count = sorted_hash_rows(&tables[i], &states, &rows);
+            if (count < 0)
+                return 1;
+            printf("Q-table for Thread %d:\n", i);
+            print_q_rows(rows, num_actions, 1, states, count);
+            printf("\n");
+            free(states);
+            free(rows);
+        }
+    }
+    if (policy == NULL && (print_type == PRINT_ALL || print_type == PRINT_NONE))
+        return 0;
+
+    struct timespec merge_start;
+    clock_gettime(CLOCK_MONOTONIC, &merge_start);
+    uint64_t trace_start = trace_begin(&main_trace);
+    QHash merged;
+    size_t max_rows = 0;
+    for (int i = 0; i < n; i++)
+        max_rows += atomic_load(&tables[i].size);
+    if (qhash_init(&merged, max_rows < (size_t)num_states ? max_rows : (size_t)num_states, num_actions) != 0) {
+        perror("Error allocating memory for merged Q-table");
+        return 1;
+    }
+    pthread_t threads[NUM_THREADS];
+    HashMergeJob jobs[NUM_THREADS];
+    for (int t = 0; t < n; t++) {
+        jobs[t] = (HashMergeJob){ tables, n, &merged, t, policy };
+        pthread_create(&threads[t], NULL, merge_hash_states_thread, &jobs[t]);
+    }
+    for (int t = 0; t < n; t++)
+        pthread_join(threads[t], NULL);
+    for (int t = 0; t < n; t++)
+        pthread_create(&threads[t], NULL, merge_hash_rows_thread, &jobs[t]);
+    for (int t = 0; t < n; t++)
+        pthread_join(threads[t], NULL);
+    phase_seconds[PHASE_MERGE] += seconds_since(merge_start);
+    trace_end(&main_trace, PHASE_MERGE, trace_start, -1);
+
+    if (print_type == PRINT_MERGED || print_type == PRINT_GREEDY) {
+        int count = sorted_hash_rows(&merged, &states, &rows);
+        if (count < 0) {
+            qhash_free(&merged);
+            return 1;
+        }
+        if (print_type == PRINT_MERGED) {
+            printf("Merged Q-table for all %d threads:\n", n);
+            print_q_rows(rows, num_actions, 1, states, count);
+        } else {
+            printf("Greedy policy for all %d threads:\n", n);
+            print_greedy_policy(rows, num_actions, 1, states, count);
+        }
+        printf("\n");
+        free(states);
+        free(rows);
+    }
+    qhash_free(&merged);
+    return 0;
+}
+
+// Offline policy evaluation (--evaluate). Episode i of a policy draws from
+// its own stream, seeded from (eval_seed, i), and its return lands in slot i,
+// so the statistics do not depend on the thread count.
+typedef enum {
+    EVAL_CONTINUE = 0,
+    EVAL_TERMINAL,
+    EVAL_OFF_SUPPORT      // The policy picked an action the dataset never took in this state
+} eval_step_result;
+
+#define EVAL_SUCCESS 0x1     // Ended in a terminal state with a positive final reward
+#define EVAL_LEFT_DATA 0x2   // Stopped at an (s, a) the empirical model has no data for
+
+typedef struct {
+    const QPolicyHeader* policy;
+    int index;                 // Policy array evaluated
+    const EmpiricalModel* model;
+    int start_episode;
+    int end_episode;
+    double* returns;           // Undiscounted return per episode
+    int* lengths;
+    unsigned char* outcomes;   // EVAL_SUCCESS | EVAL_LEFT_DATA
+} EvalThreadData;
+
+// Start states (trajectory starts) and states with any data, for EVAL_MODEL
+int* eval_starts = NULL;
+int num_eval_starts = 0;
+unsigned char* eval_state_seen = NULL;
+
+int eval_reset(uint64_t* rng) {
+    if (eval_env_type == EVAL_MODEL)
+        return eval_starts[qenv_rand_below(rng, num_eval_starts)];
+    if (eval_env_type == EVAL_TAXI)
+        return qenv_taxi_reset(rng);
+    return 0;
+}
+
+// One step of the FrozenLake or Taxi environment of qlearn_env.h
+eval_step_result eval_env_step(uint64_t* rng, int state, int action, int* next_state, double* reward) {
+    int reward_centi;
+    int done;
+    if (eval_env_type == EVAL_TAXI)
+        done = qenv_taxi_step(state, action, next_state, &reward_centi);
+    else
+        done = qenv_frozenlake_step(rng, eval_env_type == EVAL_FROZENLAKE8X8 ? 8 : 4, eval_slippery, state, action,
+                                    next_state, &reward_centi);
+    *reward = reward_centi / 100.0;
+    return done ? EVAL_TERMINAL : EVAL_CONTINUE;
+}
+
+// Sample a successor of (state, action) from the empirical model; states the
+// dataset never leaves (goals, holes, truncated ends) are terminal
+eval_step_result model_step(uint64_t* rng, const EmpiricalModel* model, int state, int action, int* next_state, double* reward) {
+    int row = state * num_actions + action;
+    int begin = model->row_offsets[row], end = model->row_offsets[row + 1];
+    if (begin == end)
+        return EVAL_OFF_SUPPORT;
+    double u = qenv_rand_unit(rng);
+    int k = begin;
+    while (k < end - 1 && u >= model->probs[k]) {
+        u -= model->probs[k];
+        k++;
+    }
+    *next_state = model->next_states[k];
+    *reward = model->next_rewards[k];
+    return eval_state_seen[*next_state] ? EVAL_CONTINUE : EVAL_TERMINAL;
+}
+
+void* evaluate_thread(void* thread_data) {
+    EvalThreadData* data = (EvalThreadData*)thread_data;
+    const uint8_t* actions = qpolicy_actions(data->policy, data->index);
+    int wide = data->policy->action_size == 2;
+    for (int i = data->start_episode; i < data->end_episode; i++) {
+        uint64_t mix = eval_seed ^ ((uint64_t)i * 0xD1B54A32D192ED03ULL);
+        uint64_t rng = qenv_splitmix64(&mix) | 1;
+        int state = eval_reset(&rng);
+        double total = 0.0;
+        int steps = 0;
+        unsigned char outcome = 0;
+        while (steps < eval_horizon) {
+            int action = wide ? ((const uint16_t*)actions)[state] : actions[state];
+            int next_state;
+            double reward;
+            eval_step_result result;
+            if (eval_env_type == EVAL_MODEL)
+                result = model_step(&rng, data->model, state, action, &next_state, &reward);
+            else
+                result = eval_env_step(&rng, state, action, &next_state, &reward);
+            if (result == EVAL_OFF_SUPPORT) {
+                outcome |= EVAL_LEFT_DATA;
+                break;
+            }
+            total += reward;
+            steps++;
+            if (result == EVAL_TERMINAL) {
+                if (reward > 0)
+                    outcome |= EVAL_SUCCESS;
+                break;
+            }
+            state = next_state;
+        }
+        data->returns[i] = total;
+        data->lengths[i] = steps;
+        data->outcomes[i] = outcome;
+    }
+    pthread_exit(NULL);
+}
+
+// Roll out every policy array of policy for eval_episodes episodes on
+// num_threads threads and print mean return, success rate and episode length.
+// model is the engine's empirical model when it already has one, else NULL.
+int evaluate_policies(const QPolicyHeader* policy, Experience* dataset, int n, const EmpiricalModel* model) {
+    struct timespec eval_start;
+    clock_gettime(CLOCK_MONOTONIC, &eval_start);
+    uint64_t trace_start = trace_begin(&main_trace);
+
+    EmpiricalModel own_model;
+    const char* env_name = "FROZENLAKE4X4";
+    int status = 0;
+    if (eval_env_type == EVAL_MODEL) {
+        env_name = "the empirical model";
+        if (model == NULL) {
+            if (build_empirical_model(dataset, n, &own_model) != 0)
+                return 1;
+            model = &own_model;
+        }
+        eval_starts = (int*)malloc((num_trajectories > 0 ? num_trajectories : 1) * sizeof(int));
+        eval_state_seen = (unsigned char*)calloc(num_states, 1);
+        if (eval_starts == NULL || eval_state_seen == NULL) {
+            perror("Error allocating memory for evaluation");
+            status = 1;
+        } else {
+            num_eval_starts = num_trajectories;
+            for (int t = 0; t < num_trajectories; t++)
+                eval_starts[t] = dataset[traj_offsets[t]].state;
+            for (int row = 0; row < model->num_rows; row++) {
+                if (model->visits[row] > 0)
+                    eval_state_seen[row / num_actions] = 1;
+            }
+        }
+        if (eval_horizon == 0)
+            eval_horizon = EVAL_HORIZON;
+    } else if (eval_env_type == EVAL_FROZENLAKE8X8) {
+        env_name = "FROZENLAKE8X8";
+        if (eval_horizon == 0)
+            eval_horizon = QENV_FROZENLAKE_LIMIT_8X8;
+    } else if (eval_env_type == EVAL_TAXI) {
+        env_name = "TAXI";
+        if (eval_horizon == 0)
+            eval_horizon = QENV_TAXI_LIMIT;
+    } else if (eval_horizon == 0) {
+        eval_horizon = QENV_FROZENLAKE_LIMIT_4X4;
+    }
+
+    double* returns = (double*)malloc(eval_episodes * sizeof(double));
+    int* lengths = (int*)malloc(eval_episodes * sizeof(int));
+    unsigned char* outcomes = (unsigned char*)malloc(eval_episodes);
+    if (status == 0 && (returns == NULL || lengths == NULL || outcomes == NULL)) {
+        perror("Error allocating memory for evaluation");
+        status = 1;
+    }
+
+    // After a failed allocation only the cleanup below runs
+    for (uint32_t p = 0; status == 0 && p < policy->num_policies; p++) {
+        pthread_t threads[NUM_THREADS];
+        EvalThreadData eval_data[NUM_THREADS];
+        for (int t = 0; t < num_threads; t++) {
+            eval_data[t].policy = policy;
+            eval_data[t].index = (int)p;
+            eval_data[t].model = model;
+            eval_data[t].start_episode = (int)((long)eval_episodes * t / num_threads);
+            eval_data[t].end_episode = (int)((long)eval_episodes * (t + 1) / num_threads);
+            eval_data[t].returns = returns;
+            eval_data[t].lengths = lengths;
+            eval_data[t].outcomes = outcomes;
+            pthread_create(&threads[t], NULL, evaluate_thread, (void*)&eval_data[t]);
+        }
+        for (int t = 0; t < num_threads; t++)
+            pthread_join(threads[t], NULL);
+
+        double sum = 0.0, sum_sq = 0.0;
+        long steps = 0;
+        int successes = 0, left_data = 0;
+        for (int i = 0; i < eval_episodes; i++) {
+            sum += returns[i];
+            sum_sq += returns[i] * returns[i];
+            steps += lengths[i];
+            successes += (outcomes[i] & EVAL_SUCCESS) != 0;
+            left_data += (outcomes[i] & EVAL_LEFT_DATA) != 0;
+        }
+        double mean = sum / eval_episodes;
+        double variance = eval_episodes > 1 ? (sum_sq - sum * mean) / (eval_episodes - 1) : 0.0;
+        double ci = 1.96 * sqrt(variance > 0 ? variance / eval_episodes : 0.0);
+
+        if (engine_type == SWEEP)
+            printf("Evaluation of config %u (alpha=%g, gamma=%g, epsilon=%g): ", p, sweep_alpha[p], sweep_gamma[p], sweep_epsilon[p]);
+        else
+            printf("Evaluation: ");
+        printf("%d episodes in %s (horizon %d): mean return %f +/- %f, success rate %.2f%%, mean length %.2f steps",
+               eval_episodes, env_name, eval_horizon, mean, ci, 100.0 * successes / eval_episodes, (double)steps / eval_episodes);
+        if (eval_env_type == EVAL_MODEL)
+            printf(", %.2f%% stopped outside the data", 100.0 * left_data / eval_episodes);
+        printf("\n");
+    }
+
+    free(returns);
+    free(lengths);
+    free(outcomes);
+    if (eval_env_type == EVAL_MODEL) {
+        free(eval_starts);
+        free(eval_state_seen);
+        if (model == &own_model)
+            free_empirical_model(&own_model);
+    }
+    if (status != 0)
+        return 1;
+    phase_seconds[PHASE_EVAL] = seconds_since(eval_start);
+    trace_end(&main_trace, PHASE_EVAL, trace_start, -1);
+    printf("Total time taken for policy evaluation: %f seconds\n", phase_seconds[PHASE_EVAL]);
+    return 0;
+}
+
+// Alternative to the sample-based threads: one pass over the dataset to build
+// the model, then value iteration on num_threads threads over a shared table.
+int run_model_engine(Experience* dataset, int n) {
+    EmpiricalModel model;
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    uint64_t trace_start = trace_begin(&main_trace);
+
+    if (build_empirical_model(dataset, n, &model) != 0)
+        return 1;
+
+    // Every failure after the model is built goes through cleanup
+    int status = 1;
+    double (*q_table)[NUM_ACTIONS] = calloc(num_states, sizeof(double[NUM_ACTIONS]));
+    double* values = (double*)calloc(num_states, sizeof(double));
+    if (q_table == NULL || values == NULL) {
+        perror("Error allocating memory for value iteration");
+        goto cleanup;
+    }
+
+    pthread_t threads[NUM_THREADS];
+    ModelThreadData model_data[NUM_THREADS];
+    all_model_data = model_data;
+    pthread_barrier_init(&sweep_barrier, NULL, num_threads);
+
+    int states_per_thread = (num_states + num_threads - 1) / num_threads;
+    for (int t = 0; t < num_threads; t++) {
+        model_data[t].model = &model;
+        model_data[t].q_table = q_table;
+        model_data[t].values = values;
+        model_data[t].start_state = t * states_per_thread < num_states ? t * states_per_thread : num_states;
+        model_data[t].end_state = (t + 1) * states_per_thread < num_states ? (t + 1) * states_per_thread : num_states;
+        model_data[t].residual = 0.0;
+        pthread_create(&threads[t], NULL, value_iteration_thread, (void*)&model_data[t]);
+    }
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    pthread_barrier_destroy(&sweep_barrier);
+
+    double total_time_taken = seconds_since(start_time);
+    phase_seconds[PHASE_TRAIN] = total_time_taken;
+    trace_end(&main_trace, PHASE_TRAIN, trace_start, -1);
+
+    struct timespec output_start;
+    clock_gettime(CLOCK_MONOTONIC, &output_start);
+    trace_start = trace_begin(&main_trace);
+    print_q_table("Q-table (model-based)", q_table);
+    QPolicyHeader* policy;
+    if (save_single_checkpoint(q_table) != 0 || save_single_policy(q_table, &policy) != 0)
+        goto cleanup;
+    phase_seconds[PHASE_OUTPUT] = seconds_since(output_start);
+    trace_end(&main_trace, PHASE_OUTPUT, trace_start, -1);
+
+    printf("Model: %d (s,a) rows, %d transitions\n", model.num_rows, model.row_offsets[model.num_rows]);
+    printf("Value iteration: %d sweeps, final residual %g\n", model_sweeps, model_residual);
+    printf("Total time taken for model build and value iteration: %f seconds\n", total_time_taken);
+    if (policy != NULL) {
+        int eval_status = evaluate_policies(policy, dataset, n, &model);
+        free(policy);
+        if (eval_status != 0)
+            goto cleanup;
+    }
+    status = 0;
+
+cleanup:
+    free(q_table);
+    free(values);
+    free_empirical_model(&model);
+    return status;
+}
+
+// Prioritized sweeping. Rows are sharded by state (state % num_threads); only
+// the owner thread writes Q(s,*) and pops its shard's queue, while any thread
+// may push a predecessor into another shard under that shard's lock.
+typedef struct {
+    int* offsets;   // num_states + 1 offsets into rows / probs
+    int* rows;      // (s,a) rows that can transition into the state
+    double* probs;  // P(state | row)
+} PredecessorIndex;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int size;
+    int capacity;
+    int* heap;      // Max-heap of rows ordered by sweep_priority
+} SweepQueue;
+
+typedef struct {
+    int thread_id;
+    EmpiricalModel* model;
+    PredecessorIndex* preds;
+    double (*q_table)[NUM_ACTIONS];
+    long backups;
+} SweepThreadData;
+
+SweepQueue sweep_queues[NUM_THREADS];
+int* sweep_heap_pos;       // Position of each row in its shard's heap, -1 if not queued
+double* sweep_priority;    // Priority of each queued row
+atomic_long sweep_pending; // Queued rows plus rows being processed
+atomic_long sweep_budget;  // Backups left before the engine gives up
+// max(0, max_a Q(s,a)) of each state as last published by its owning shard.
+// Only the owner touches a state's Q row; other shards read its value here.
+_Atomic double* sweep_values;
+
+int build_predecessor_index(EmpiricalModel* model, PredecessorIndex* preds) {
+    int nnz = model->row_offsets[model->num_rows];
+    preds->offsets = (int*)calloc(num_states + 1, sizeof(int));
+    preds->rows = (int*)malloc((nnz > 0 ? nnz : 1) * sizeof(int));
+    preds->probs = (double*)malloc((nnz > 0 ? nnz : 1) * sizeof(double));
+    int* cursor = (int*)malloc((num_states + 1) * sizeof(int));
+    if (preds->offsets == NULL || preds->rows == NULL || preds->probs == NULL || cursor == NULL) {
+        perror("Error allocating memory for the predecessor index");
+        free(cursor);
+        return 1;
+    }
+
+    for (int k = 0; k < nnz; k++)
+        preds->offsets[model->next_states[k] + 1]++;
+    for (int s = 0; s < num_states; s++)
+        preds->offsets[s + 1] += preds->offsets[s];
+    memcpy(cursor, preds->offsets, (num_states + 1) * sizeof(int));
+    for (int row = 0; row < model->num_rows; row++) {
+        for (int k = model->row_offsets[row]; k < model->row_offsets[row + 1]; k++) {
+            int pos = cursor[model->next_states[k]]++;
+            preds->rows[pos] = row;
+            preds->probs[pos] = model->probs[k];
+        }
+    }
+
+    free(cursor);
+    return 0;
+}
+
+void sweep_heap_swap(SweepQueue* queue, int i, int j) {
+    int row_i = queue->heap[i];
+    int row_j = queue->heap[j];
+    queue->heap[i] = row_j;
+    queue->heap[j] = row_i;
+    sweep_heap_pos[row_j] = i;
+    sweep_heap_pos[row_i] = j;
+}
+
+void sweep_heap_up(SweepQueue* queue, int i) {
+    while (i > 0 && sweep_priority[queue->heap[(i - 1) / 2]] < sweep_priority[queue->heap[i]]) {
+        sweep_heap_swap(queue, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+void sweep_heap_down(SweepQueue* queue, int i) {
+    for (;;) {
+        int largest = i;
+        int left = 2 * i + 1, right = 2 * i + 2;
+        if (left < queue->size && sweep_priority[queue->heap[left]] > sweep_priority[queue->heap[largest]])
+            largest = left;
+        if (right < queue->size && sweep_priority[queue->heap[right]] > sweep_priority[queue->heap[largest]])
+            largest = right;
+        if (largest == i)
+            return;
+        sweep_heap_swap(queue, i, largest);
+        i = largest;
+    }
+}
+
+// Queue a row or raise its priority. A full queue replaces its last leaf
+// (one of the lowest priorities) when the new row is more urgent.
+void sweep_push(int row, double priority) {
+    SweepQueue* queue = &sweep_queues[(row / num_actions) % num_threads];
+    pthread_mutex_lock(&queue->lock);
+    if (sweep_heap_pos[row] >= 0) {
+        if (priority > sweep_priority[row]) {
+            sweep_priority[row] = priority;
+            sweep_heap_up(queue, sweep_heap_pos[row]);
+        }
+    } else if (queue->size < queue->capacity) {
+        sweep_priority[row] = priority;
+        sweep_heap_pos[row] = queue->size;
+        queue->heap[queue->size++] = row;
+        atomic_fetch_add(&sweep_pending, 1);
+        sweep_heap_up(queue, queue->size - 1);
+    } else if (priority > sweep_priority[queue->heap[queue->size - 1]]) {
+        int leaf = queue->size - 1;
+        sweep_heap_pos[queue->heap[leaf]] = -1;
+        sweep_priority[row] = priority;
+        sweep_heap_pos[row] = leaf;
+        queue->heap[leaf] = row;
+        sweep_heap_up(queue, leaf);
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+int sweep_pop(SweepQueue* queue) {
+    int row = -1;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->size > 0) {
+        row = queue->heap[0];
+        sweep_heap_pos[row] = -1;
+        queue->size--;
+        if (queue->size > 0) {
+            queue->heap[0] = queue->heap[queue->size];
+            sweep_heap_pos[queue->heap[0]] = 0;
+            sweep_heap_down(queue, 0);
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return row;
+}
+
+// Value of a state owned by the calling shard, read from its own Q row
+double state_value(double (*q_table)[NUM_ACTIONS], int s) {
+    double best = 0;
+    for (int a = 0; a < num_actions; a++)
+        best = q_table[s][a] > best ? q_table[s][a] : best;
+    return best;
+}
+
+void* prioritized_sweep_thread(void* thread_data) {
+    SweepThreadData* data = (SweepThreadData*)thread_data;
+    EmpiricalModel* model = data->model;
+    PredecessorIndex* preds = data->preds;
+    double (*q_table)[NUM_ACTIONS] = data->q_table;
+    SweepQueue* queue = &sweep_queues[data->thread_id];
+    double theta = convergence_tol > 0 ? convergence_tol : VALUE_ITERATION_TOL;
+
+    // Seed the shard: with Q = 0 the first backup of a row moves it by |R(s,a)|
+    for (int s = data->thread_id; s < num_states; s += num_threads) {
+        for (int a = 0; a < num_actions; a++) {
+            int row = s * num_actions + a;
+            double priority = model->rewards[row] < 0 ? -model->rewards[row] : model->rewards[row];
+            if (model->visits[row] > 0 && priority > theta)
+                sweep_push(row, priority);
+        }
+    }
+    pthread_barrier_wait(&sweep_barrier);
+
+    while (atomic_load(&sweep_pending) > 0) {
+        int row = sweep_pop(queue);
+        if (row < 0) {
+            sched_yield();
+            continue;
+        }
+        if (atomic_fetch_sub(&sweep_budget, 1) <= 0) {
+            atomic_fetch_sub(&sweep_pending, 1);
+            continue;
+        }
+
+        int s = row / num_actions;
+        int a = row % num_actions;
+        double expected = 0.0;
+        for (int k = model->row_offsets[row]; k < model->row_offsets[row + 1]; k++)
+            expected += model->probs[k] *
+                        atomic_load_explicit(&sweep_values[model->next_states[k]], memory_order_relaxed);
+
+        double old_value = state_value(q_table, s);
+        q_table[s][a] = model->rewards[row] + GAMMA * expected;
+        double new_value = state_value(q_table, s);
+        atomic_store_explicit(&sweep_values[s], new_value, memory_order_relaxed);
+        double value_change = new_value - old_value;
+        if (value_change < 0)
+            value_change = -value_change;
+        data->backups++;
 
-    // Perform Q-value update
-    double max_next_q = 0;
-    for (int next_a = 0; next_a < num_actions; next_a++) {
-        if (q_table[next_s][next_a] > max_next_q) {
-            max_next_q = q_table[next_s][next_a];
+        if (value_change > 0) {
+            for (int k = preds->offsets[s]; k < preds->offsets[s + 1]; k++) {
+                double priority = GAMMA * preds->probs[k] * value_change;
+                if (priority > theta)
+                    sweep_push(preds->rows[k], priority);
+            }
         }
+        atomic_fetch_sub(&sweep_pending, 1);
     }
 
-    //pthread_mutex_lock(&q_table_mutex);
-    q_table[s][a] += ALPHA * (r + GAMMA * max_next_q - q_table[s][a]);
-    //pthread_mutex_unlock(&q_table_mutex);
+    pthread_exit(NULL);
 }
 
-// Function to choose the next action based on the epsilon-greedy policy
-int sarsa_choose_action(unsigned int *seed, int state, double (*q_table) [num_actions]) {
-    unsigned int rand_val = (double)custom_rand(seed) / RAND_MAX;
-    if (rand_val < EPSILON) {
-        // Exploration: choose a random action
-        return rand_val % num_actions;
-    } else {
-        // Exploitation: choose the best action based on the Q-table
-        int best_action = 0;
-        double best_value = q_table[state][0];
-        for (int a = 1; a < num_actions; a++) {
-            if (q_table[state][a] > best_value) {
-                best_value = q_table[state][a];
-                best_action = a;
-            }
+// Prioritized sweeping over the empirical model: backups are spent only where
+// a successor's value actually moved, in order of how much it moved.
+int run_psweep_engine(Experience* dataset, int n) {
+    EmpiricalModel model;
+    PredecessorIndex preds;
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    uint64_t trace_start = trace_begin(&main_trace);
+
+    if (build_empirical_model(dataset, n, &model) != 0)
+        return 1;
+
+    // Every failure after the model is built goes through cleanup; shards
+    // counts the queues initialised so far
+    int status = 1;
+    int shards = 0;
+    double (*q_table)[NUM_ACTIONS] = NULL;
+    sweep_heap_pos = NULL;
+    sweep_priority = NULL;
+    sweep_values = NULL;
+    if (build_predecessor_index(&model, &preds) != 0)
+        goto cleanup;
+
+    q_table = calloc(num_states, sizeof(double[NUM_ACTIONS]));
+    sweep_heap_pos = (int*)malloc(model.num_rows * sizeof(int));
+    sweep_priority = (double*)calloc(model.num_rows, sizeof(double));
+    sweep_values = (_Atomic double*)malloc(num_states * sizeof(_Atomic double));
+    if (q_table == NULL || sweep_heap_pos == NULL || sweep_priority == NULL || sweep_values == NULL) {
+        perror("Error allocating memory for prioritized sweeping");
+        goto cleanup;
+    }
+    for (int row = 0; row < model.num_rows; row++)
+        sweep_heap_pos[row] = -1;
+    for (int s = 0; s < num_states; s++)
+        atomic_init(&sweep_values[s], 0.0);
+
+    // A shard never holds more rows than it owns
+    int rows_per_shard = ((num_states + num_threads - 1) / num_threads) * num_actions;
+    int capacity = rows_per_shard < PSWEEP_QUEUE_CAPACITY ? rows_per_shard : PSWEEP_QUEUE_CAPACITY;
+    for (int t = 0; t < num_threads; t++) {
+        pthread_mutex_init(&sweep_queues[t].lock, NULL);
+        sweep_queues[t].size = 0;
+        sweep_queues[t].capacity = capacity;
+        sweep_queues[t].heap = (int*)malloc((capacity > 0 ? capacity : 1) * sizeof(int));
+        shards++;
+        if (sweep_queues[t].heap == NULL) {
+            perror("Error allocating memory for prioritized sweeping");
+            goto cleanup;
         }
-        return best_action;
     }
-}
+    atomic_store(&sweep_pending, 0);
+    atomic_store(&sweep_budget, (long)num_episodes * model.num_rows);
 
-void update_q_table_sarsa(unsigned int *seed, Experience experience, double (*q_table)[num_actions]) {
-    int s = experience.state;
-    int a = experience.action;
-    double r = experience.reward;
-    int next_s = experience.next_state;
+    pthread_t threads[NUM_THREADS];
+    SweepThreadData sweep_data[NUM_THREADS];
+    pthread_barrier_init(&sweep_barrier, NULL, num_threads);
+    for (int t = 0; t < num_threads; t++) {
+        sweep_data[t].thread_id = t;
+        sweep_data[t].model = &model;
+        sweep_data[t].preds = &preds;
+        sweep_data[t].q_table = q_table;
+        sweep_data[t].backups = 0;
+        pthread_create(&threads[t], NULL, prioritized_sweep_thread, (void*)&sweep_data[t]);
+    }
+    long backups = 0;
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+        backups += sweep_data[t].backups;
+    }
+    pthread_barrier_destroy(&sweep_barrier);
 
-    // Determine the next action based on the current policy
-    int next_a = sarsa_choose_action(seed, next_s, q_table);
+    double total_time_taken = seconds_since(start_time);
+    phase_seconds[PHASE_TRAIN] = total_time_taken;
+    trace_end(&main_trace, PHASE_TRAIN, trace_start, -1);
 
-    // SARSA Q-value update
-    double next_q = q_table[next_s][next_a];
-    q_table[s][a] += ALPHA * (r + GAMMA * next_q - q_table[s][a]);
-}
+    struct timespec output_start;
+    clock_gettime(CLOCK_MONOTONIC, &output_start);
+    trace_start = trace_begin(&main_trace);
+    print_q_table("Q-table (prioritized sweeping)", q_table);
+    QPolicyHeader* policy;
+    if (save_single_checkpoint(q_table) != 0 || save_single_policy(q_table, &policy) != 0)
+        goto cleanup;
+    phase_seconds[PHASE_OUTPUT] = seconds_since(output_start);
+    trace_end(&main_trace, PHASE_OUTPUT, trace_start, -1);
 
+    printf("Model: %d (s,a) rows, %d transitions\n", model.num_rows, model.row_offsets[model.num_rows]);
+    printf("Prioritized sweeping: %ld backups (%.4f backups per sample)%s\n", backups, n > 0 ? (double)backups / n : 0.0,
+           atomic_load(&sweep_budget) < 0 ? ", stopped at the backup budget" : "");
+    printf("Total time taken for model build and prioritized sweeping: %f seconds\n", total_time_taken);
+    if (policy != NULL) {
+        int eval_status = evaluate_policies(policy, dataset, n, &model);
+        free(policy);
+        if (eval_status != 0)
+            goto cleanup;
+    }
+    status = 0;
 
-void* update_seq_thread(void* thread_data) {
-    ThreadData* data = (ThreadData*)thread_data;
-    unsigned int seed = 42;
+cleanup:
+    for (int t = 0; t < shards; t++) {
+        pthread_mutex_destroy(&sweep_queues[t].lock);
+        free(sweep_queues[t].heap);
+    }
+    free(sweep_heap_pos);
+    free(sweep_priority);
+    free((void*)sweep_values);
+    free(preds.offsets);
+    free(preds.rows);
+    free(preds.probs);
+    free(q_table);
+    free_empirical_model(&model);
+    return status;
+}
 
-    for (int episode = 0; episode < NUM_EPISODES; episode++) {
-        for (int i = data->start_index; i < data->end_index; i++) {
-            if (algorithm_type == QLEARN ) 
-                update_q_table(data->dataset[i], data->q_table);
-            else 
-                update_q_table_sarsa(&seed, data->dataset[i], data->q_table);
-        }
+// Parse a comma separated list of numbers; returns how many were read
+int parse_list(char* str, double* values, int max_values) {
+    int count = 0;
+    char* end;
+    while (*str != '\0') {
+        if (count == max_values)
+            return -1;
+        values[count++] = strtod(str, &end);
+        if (end == str)
+            return -1;
+        str = (*end == ',') ? end + 1 : end;
+        if (*end != ',' && *end != '\0')
+            return -1;
     }
+    return count;
+}
 
-    pthread_exit(NULL);
+
+// Sum of counter c over the threads, or -1 if any thread could not count it
+long long total_counter(const ThreadData* threads, int n, int c) {
+    long long total = 0;
+    for (int t = 0; t < n; t++) {
+        if (threads[t].counters[c] < 0)
+            return -1;
+        total += threads[t].counters[c];
+    }
+    return total;
 }
 
-void* update_rand_thread(void* thread_data) {
-    ThreadData* data = (ThreadData*)thread_data;
-    unsigned int seed = 42;
-    unsigned int rand_seed = 42;
+long total_updates(const ThreadData* threads, int n) {
+    long updates = 0;
+    for (int t = 0; t < n; t++)
+        updates += threads[t].updates;
+    return updates;
+}
 
-    for (int episode = 0; episode < NUM_EPISODES; episode++) {
-        for (int i = data->start_index; i < data->end_index; i++) {
-            int random_index = custom_rand(&rand_seed) % (data->end_index - data->start_index) + data->start_index ;
-            if (algorithm_type == QLEARN) 
-                update_q_table(data->dataset[random_index], data->q_table);
-            else 
-                update_q_table_sarsa(&seed, data->dataset[random_index], data->q_table);
+void print_counters(const ThreadData* threads, int n) {
+    for (int t = 0; t < n; t++) {
+        printf("Counters for Thread %d:", t);
+        for (int c = 0; c < NUM_COUNTERS; c++) {
+            if (threads[t].counters[c] >= 0)
+                printf(" %s=%lld", counter_names[c], threads[t].counters[c]);
+            else
+                printf(" %s=n/a", counter_names[c]);
         }
+        printf("\n");
     }
+    long updates = total_updates(threads, n);
+    printf("Counters per update:");
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        long long total = total_counter(threads, n, c);
+        if (total >= 0 && updates > 0)
+            printf(" %s=%.3f", counter_names[c], (double)total / updates);
+        else
+            printf(" %s=n/a", counter_names[c]);
+    }
+    long long cycles = total_counter(threads, n, 0), instructions = total_counter(threads, n, 1);
+    if (cycles > 0 && instructions >= 0)
+        printf(" ipc=%.3f", (double)instructions / cycles);
+    printf("\n");
+}
 
-    pthread_exit(NULL);
+void print_json_string(FILE* out, const char* str) {
+    fputc('"', out);
+    for (; *str != '\0'; str++) {
+        if (*str == '"' || *str == '\\')
+            fprintf(out, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            fprintf(out, "\\u%04x", (unsigned char)*str);
+        else
+            fputc(*str, out);
+    }
+    fputc('"', out);
 }
 
-void* update_stride_thread(void* thread_data) {
-    ThreadData* data = (ThreadData*)thread_data;
-    unsigned int seed = 42;
+// Timing report for --report. threads is NULL for the single-table engines.
+// CSV is one "dataset,sampling,algorithm,metric,thread,value" row per number,
+// with an empty thread column for whole-run metrics.
+int write_report(const char* filepath, const char* sampling_str, const char* algorithm_str, int num_s,
+                 double total_seconds, const ThreadData* threads, int n) {
+    FILE* out = strcmp(report_path, "-") == 0 ? stdout : fopen(report_path, "w");
+    if (out == NULL) {
+        perror(report_path);
+        return 1;
+    }
 
-    for (int episode = 0; episode < NUM_EPISODES; episode++) {
-        for (int stride_idx=0; stride_idx < NUM_STRIDE; stride_idx++) {
-            int size = data->end_index - data->start_index;
-            for (int i = 0; i < size / NUM_STRIDE; i++) {
-                int index = stride_idx + i * NUM_STRIDE;
-                if (algorithm_type == QLEARN) 
-                    update_q_table(data->dataset[index], data->q_table);
-                else 
-                    update_q_table_sarsa(&seed, data->dataset[index], data->q_table);
+    long updates = threads != NULL ? total_updates(threads, n) : 0;
+    long hist[LATENCY_BUCKETS] = { 0 };
+    int last_bucket = -1;
+    for (int t = 0; threads != NULL && t < n; t++) {
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            hist[b] += threads[t].episode_hist[b];
+            if (hist[b] > 0 && b > last_bucket)
+                last_bucket = b;
+        }
+    }
+    double train = phase_seconds[PHASE_TRAIN];
+    double rate = train > 0 ? updates / train : 0.0;
+
+    if (report_type == REPORT_JSON) {
+        fprintf(out, "{\n  \"dataset\": ");
+        print_json_string(out, filepath);
+        fprintf(out, ",\n  \"sampling\": ");
+        print_json_string(out, sampling_str);
+        fprintf(out, ",\n  \"algorithm\": ");
+        print_json_string(out, algorithm_str);
+        fprintf(out, ",\n  \"engine\": %d,\n  \"update\": %d,\n", engine_type, update_type);
+        fprintf(out, "  \"samples\": %d,\n  \"threads\": %d,\n  \"episodes\": %d,\n", num_s, num_threads, episodes_run);
+        fprintf(out, "  \"phases\": {");
+        for (int ph = 0; ph < NUM_PHASES; ph++)
+            fprintf(out, "%s\"%s\": %.9f", ph > 0 ? ", " : " ", phase_names[ph], phase_seconds[ph]);
+        fprintf(out, " },\n  \"total_seconds\": %.9f,\n", total_seconds);
+        fprintf(out, "  \"updates\": %ld,\n  \"updates_per_second\": %.1f,\n", updates, rate);
+        fprintf(out, "  \"per_thread\": [");
+        for (int t = 0; threads != NULL && t < n; t++) {
+            const ThreadData* d = &threads[t];
+            fprintf(out, "%s\n    { \"thread\": %d, \"cpu_seconds\": %.9f, \"wall_seconds\": %.9f, \"updates\": %ld, "
+                    "\"updates_per_second\": %.1f, \"episodes\": %d, \"episode_min\": %.9f, \"episode_mean\": %.9f, "
+                    "\"episode_max\": %.9f", t > 0 ? "," : "", t, d->cpu_seconds, d->wall_seconds, d->updates,
+                    d->wall_seconds > 0 ? d->updates / d->wall_seconds : 0.0, d->episodes_timed, d->episode_min,
+                    d->episodes_timed > 0 ? d->episode_sum / d->episodes_timed : 0.0, d->episode_max);
+            for (int c = 0; perf_enabled && c < NUM_COUNTERS; c++) {
+                if (d->counters[c] >= 0)
+                    fprintf(out, ", \"%s\": %lld", counter_names[c], d->counters[c]);
+                else
+                    fprintf(out, ", \"%s\": null", counter_names[c]);
+            }
+            fprintf(out, " }");
+        }
+        fprintf(out, "%s],\n", threads != NULL && n > 0 ? "\n  " : "");
+        fprintf(out, "  \"episode_latency_us\": { \"bucket_lower_bounds\": [");
+        for (int b = 0; b <= last_bucket; b++)
+            fprintf(out, "%s%ld", b > 0 ? ", " : "", b == 0 ? 0L : 1L << b);
+        fprintf(out, "], \"counts\": [");
+        for (int b = 0; b <= last_bucket; b++)
+            fprintf(out, "%s%ld", b > 0 ? ", " : "", hist[b]);
+        fprintf(out, "] }");
+        if (perf_enabled && threads != NULL) {
+            fprintf(out, ",\n  \"counters_per_update\": {");
+            for (int c = 0; c < NUM_COUNTERS; c++) {
+                long long total = total_counter(threads, n, c);
+                if (total >= 0 && updates > 0)
+                    fprintf(out, "%s\"%s\": %.6f", c > 0 ? ", " : " ", counter_names[c], (double)total / updates);
+                else
+                    fprintf(out, "%s\"%s\": null", c > 0 ? ", " : " ", counter_names[c]);
+            }
+            fprintf(out, " }");
+        }
+        fprintf(out, "\n}\n");
+    } else {
+        fprintf(out, "dataset,sampling,algorithm,metric,thread,value\n");
+#define CSV_ROW(metric, thread, fmt, value) \
+        fprintf(out, "%s,%s,%s,%s,%s," fmt "\n", filepath, sampling_str, algorithm_str, metric, thread, value)
+        char metric[64], thread[16];
+        for (int ph = 0; ph < NUM_PHASES; ph++) {
+            snprintf(metric, sizeof(metric), "%s_seconds", phase_names[ph]);
+            CSV_ROW(metric, "", "%.9f", phase_seconds[ph]);
+        }
+        CSV_ROW("total_seconds", "", "%.9f", total_seconds);
+        CSV_ROW("samples", "", "%d", num_s);
+        CSV_ROW("episodes", "", "%d", episodes_run);
+        CSV_ROW("updates", "", "%ld", updates);
+        CSV_ROW("updates_per_second", "", "%.1f", rate);
+        for (int t = 0; threads != NULL && t < n; t++) {
+            const ThreadData* d = &threads[t];
+            snprintf(thread, sizeof(thread), "%d", t);
+            CSV_ROW("cpu_seconds", thread, "%.9f", d->cpu_seconds);
+            CSV_ROW("wall_seconds", thread, "%.9f", d->wall_seconds);
+            CSV_ROW("updates", thread, "%ld", d->updates);
+            CSV_ROW("updates_per_second", thread, "%.1f", d->wall_seconds > 0 ? d->updates / d->wall_seconds : 0.0);
+            CSV_ROW("episode_min_seconds", thread, "%.9f", d->episode_min);
+            CSV_ROW("episode_mean_seconds", thread, "%.9f", d->episodes_timed > 0 ? d->episode_sum / d->episodes_timed : 0.0);
+            CSV_ROW("episode_max_seconds", thread, "%.9f", d->episode_max);
+            for (int c = 0; perf_enabled && c < NUM_COUNTERS; c++) {
+                if (d->counters[c] >= 0)
+                    CSV_ROW(counter_names[c], thread, "%lld", d->counters[c]);
+            }
+        }
+        for (int c = 0; perf_enabled && threads != NULL && c < NUM_COUNTERS; c++) {
+            long long total = total_counter(threads, n, c);
+            if (total >= 0 && updates > 0) {
+                snprintf(metric, sizeof(metric), "%s_per_update", counter_names[c]);
+                CSV_ROW(metric, "", "%.6f", (double)total / updates);
             }
         }
+        for (int b = 0; b <= last_bucket; b++) {
+            snprintf(metric, sizeof(metric), "episode_latency_us_ge_%ld", b == 0 ? 0L : 1L << b);
+            CSV_ROW(metric, "", "%ld", hist[b]);
+        }
+#undef CSV_ROW
     }
 
-    pthread_exit(NULL);
+    if (out == stdout)
+        return 0;
+    if (fclose(out) != 0) {
+        perror(report_path);
+        return 1;
+    }
+    return 0;
 }
 
+// Events of one ring, oldest first, as Chrome trace-event "X" records on
+// thread tid (timestamps in microseconds)
+void print_trace_ring(FILE* out, const TraceRing* ring, int tid) {
+    uint64_t first = ring->written > TRACE_RING_EVENTS ? ring->written - TRACE_RING_EVENTS : 0;
+    for (uint64_t i = first; i < ring->written; i++) {
+        const TraceEvent* event = &ring->events[i & (TRACE_RING_EVENTS - 1)];
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                trace_names[event->name], event->name < NUM_PHASES ? "phase" : "worker", tid, event->start / 1e3, event->duration / 1e3);
+        if (event->arg >= 0)
+            fprintf(out, ",\"args\":{\"episode\":%d}", event->arg);
+        fprintf(out, "}");
+    }
+    if (first > 0)
+        fprintf(stderr, "Trace of %s %d wrapped: kept the last %d of %llu spans\n", tid == 0 ? "main thread" : "worker", tid - 1,
+                TRACE_RING_EVENTS, (unsigned long long)ring->written);
+}
+
+// Timeline for --trace, loadable in chrome://tracing or Perfetto. The main
+// thread is tid 0 with the run phases, worker t is tid t + 1; threads is NULL
+// for the single-table engines.
+int write_trace(const ThreadData* threads, int n) {
+    FILE* out = fopen(trace_path, "w");
+    if (out == NULL) {
+        perror(trace_path);
+        return 1;
+    }
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"threaded_Baseline\"}},\n");
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"main\"}}");
+    for (int t = 0; threads != NULL && t < n; t++) {
+        fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"worker %d (%ld samples per episode)\"}}",
+                t + 1, t, threads[t].pass_samples);
+    }
+    print_trace_ring(out, &main_trace, 0);
+    for (int t = 0; threads != NULL && t < n; t++)
+        print_trace_ring(out, &threads[t].trace, t + 1);
+    fprintf(out, "\n]}\n");
+    if (fclose(out) != 0) {
+        perror(trace_path);
+        return 1;
+    }
+    return 0;
+}
 
 
-int main(int argc, char *argv[]) {
+int run_job(int argc, char *argv[]) {
     // Check if the correct number of arguments is provided
-    if (argc != 7) {
-        fprintf(stderr, "Usage: %s <filepath> <num_states> <num_actions> <num_samples> <sampling> <algorithm>\n", argv[0]);
+    if (argc < 7) {
+        fprintf(stderr, "Usage: %s <filepath> <num_states> <num_actions> <num_samples> <sampling> <algorithm> [options]\n", argv[0]);
+        fprintf(stderr, "       %s --manifest=<file> [options applied to every job]\n", argv[0]);
+        fprintf(stderr, "Algorithms: QLEARN SARSA QLAMBDA SARSALAMBDA SARSALOGGED (needs a 5th next_action column)\n");
+        fprintf(stderr, "Options:\n");
+        fprintf(stderr, "  --threads=<N>                         worker threads, 1..%d (default %d)\n", NUM_THREADS, NUM_THREADS);
+        fprintf(stderr, "  --episodes=<N>                        passes over the data (default %d); for MODEL the most value\n", NUM_EPISODES);
+        fprintf(stderr, "                                        iteration sweeps, for PSWEEP the backup budget per (s,a)\n");
+        fprintf(stderr, "  --update=ONLINE|BATCH_SUM|BATCH_MEAN  apply samples one by one or in mini-batches of %d\n", BATCH_SIZE);
+        fprintf(stderr, "  --tol=<x>                             stop once max |dQ| per episode stays below x\n");
+        fprintf(stderr, "  --patience=<M>                        consecutive episodes below --tol required (default %d)\n", CONVERGENCE_PATIENCE);
+        fprintf(stderr, "  --lambda=<x>                          trace decay for QLAMBDA/SARSALAMBDA, not with BACKWARD (default %g)\n", LAMBDA);
+        fprintf(stderr, "  --trace-cutoff=<x>                    drop eligibility traces below x (default %g)\n", TRACE_CUTOFF);
+        fprintf(stderr, "  --engine=SAMPLE|MODEL|PSWEEP|SWEEP    replay samples, or solve the empirical MDP by value iteration\n");
+        fprintf(stderr, "                                        or prioritized sweeping (stop at residual --tol, default %g),\n", VALUE_ITERATION_TOL);
+        fprintf(stderr, "                                        or replay samples into every configuration of a grid\n");
+        fprintf(stderr, "  --alphas=<a,b,..> --gammas=<..> --epsilons=<..>  SWEEP grid (up to %d configurations)\n", MAX_SWEEP_CONFIGS);
+        fprintf(stderr, "  --table=DENSE|HASH                    per-thread tables as arrays of up to %d states, or hash maps holding\n", NUM_STATES);
+        fprintf(stderr, "                                        only the states the data updates (SAMPLE engine, QLEARN/SARSA/\n");
+        fprintf(stderr, "                                        SARSALOGGED, ONLINE; no --tol, --state-file, --publish, --checkpoint)\n");
+        fprintf(stderr, "  --actions=DATA|<file>                 per-state action sets, from the samples or from lines of\n");
+        fprintf(stderr, "                                        '<state> <action> ...' (unlisted states keep all actions); rows\n");
+        fprintf(stderr, "                                        only hold those actions (SAMPLE engine, QLEARN/SARSA/SARSALOGGED,\n");
+        fprintf(stderr, "                                        ONLINE; no --table=HASH, --tol, --state-file, --publish)\n");
+        fprintf(stderr, "  --fixed=16|32:<F>                     keep Q values as 16- or 32-bit integers with F fraction bits, with\n");
+        fprintf(stderr, "                                        saturating updates (SAMPLE engine, QLEARN/SARSA/SARSALOGGED,\n");
+        fprintf(stderr, "                                        ONLINE, dense tables; no --tol, --state-file, --publish)\n");
+        fprintf(stderr, "  --fixed-check                         also train double tables and report the fixed-point error and\n");
+        fprintf(stderr, "                                        the states whose greedy action changed\n");
+        fprintf(stderr, "  --renumber                            renumber states by visit count so the hot rows are adjacent\n");
+        fprintf(stderr, "                                        (SAMPLE and SWEEP engines; output keeps the original IDs)\n");
+        fprintf(stderr, "  --print=ALL|MERGED|GREEDY|NONE        final tables to print: per thread, their mean, its greedy policy, or none\n");
+        fprintf(stderr, "  --checkpoint=<path>                   also write the final tables in the binary format of qlearn_formats.h\n");
+        fprintf(stderr, "  --policy=<path>                       write the merged table's greedy action per state (uint8/uint16 per state)\n");
+        fprintf(stderr, "  --evaluate=<N>                        roll out the greedy policy for N episodes and report mean return and\n");
+        fprintf(stderr, "                                        success rate, in --eval-env=MODEL|FROZENLAKE4X4|FROZENLAKE8X8|TAXI\n");
+        fprintf(stderr, "                                        (default MODEL: the dataset's empirical MDP); --eval-horizon=<steps>,\n");
+        fprintf(stderr, "                                        --eval-seed=<n>, --eval-slippery=0|1 (FrozenLake, default 1)\n");
+        fprintf(stderr, "  --report=<path>|-                     write wall time per phase, per-thread CPU time, updates/sec and\n");
+        fprintf(stderr, "  --report-format=JSON|CSV              episode latency histograms (default JSON)\n");
+        fprintf(stderr, "  --trace=<path>                        write a Chrome trace-event timeline of the run phases and, for the\n");
+        fprintf(stderr, "                                        SAMPLE and SWEEP engines, each worker's episodes, barriers and snapshots\n");
+        fprintf(stderr, "  --stats=<path>                        publish live per-thread progress in a shared page for qstat\n");
+        fprintf(stderr, "                                        (SAMPLE and SWEEP engines; e.g. /dev/shm/<name>)\n");
+        fprintf(stderr, "  --publish=<path>                      publish the merged table(s) in a shared mapping every\n");
+        fprintf(stderr, "  --publish-every=<N>                   N episodes (default %d) and at the end (SAMPLE and SWEEP engines)\n", PUBLISH_EVERY);
+        fprintf(stderr, "  --perf                                count cycles, instructions, L1D/LLC/dTLB and branch misses per thread\n");
+        fprintf(stderr, "                                        in the sample loops (SAMPLE and SWEEP engines)\n");
+        fprintf(stderr, "  --state-file=<path>                   snapshot the training state every --save-every=<N> episodes (default %d)\n", SAVE_EVERY);
+        fprintf(stderr, "  --resume                              continue from the snapshot in --state-file (same arguments otherwise)\n");
         return EXIT_FAILURE;
     }
 
@@ -196,6 +3534,8 @@ int main(int argc, char *argv[]) {
         sampling_type = RANDOM;
     } else if (strcmp(sampling_str, "STRIDE") == 0) {
         sampling_type = STRIDE;
+    } else if (strcmp(sampling_str, "BACKWARD") == 0) {
+        sampling_type = BACKWARD;
     } else {
         fprintf(stderr, "Invalid sampling type: %s\n", sampling_str);
         return EXIT_FAILURE;
@@ -206,11 +3546,295 @@ int main(int argc, char *argv[]) {
         algorithm_type = QLEARN;
     } else if (strcmp(algorithm_str, "SARSA") == 0) {
         algorithm_type = SARSA;
+    } else if (strcmp(algorithm_str, "QLAMBDA") == 0) {
+        algorithm_type = QLAMBDA;
+    } else if (strcmp(algorithm_str, "SARSALAMBDA") == 0) {
+        algorithm_type = SARSALAMBDA;
+    } else if (strcmp(algorithm_str, "SARSALOGGED") == 0) {
+        algorithm_type = SARSALOGGED;
     } else {
         fprintf(stderr, "Invalid algorithm type: %s\n", algorithm_str);
         return EXIT_FAILURE;
     }
 
+    // Optional flags
+    double alphas[MAX_SWEEP_CONFIGS] = { ALPHA };
+    double gammas[MAX_SWEEP_CONFIGS] = { GAMMA };
+    double epsilons[MAX_SWEEP_CONFIGS] = { EPSILON };
+    int num_alphas = 1, num_gammas = 1, num_epsilons = 1;
+    for (int i = 7; i < argc; i++) {
+        if (strncmp(argv[i], "--update=", 9) == 0) {
+            char *update_str = argv[i] + 9;
+            if (strcmp(update_str, "ONLINE") == 0) {
+                update_type = ONLINE;
+            } else if (strcmp(update_str, "BATCH_SUM") == 0) {
+                update_type = BATCH_SUM;
+            } else if (strcmp(update_str, "BATCH_MEAN") == 0) {
+                update_type = BATCH_MEAN;
+            } else {
+                fprintf(stderr, "Invalid update mode: %s\n", update_str);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--engine=", 9) == 0) {
+            char *engine_str = argv[i] + 9;
+            if (strcmp(engine_str, "SAMPLE") == 0) {
+                engine_type = SAMPLE;
+            } else if (strcmp(engine_str, "MODEL") == 0) {
+                engine_type = MODEL;
+            } else if (strcmp(engine_str, "PSWEEP") == 0) {
+                engine_type = PSWEEP;
+            } else if (strcmp(engine_str, "SWEEP") == 0) {
+                engine_type = SWEEP;
+            } else {
+                fprintf(stderr, "Invalid engine: %s\n", engine_str);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--table=", 8) == 0) {
+            char *table_str = argv[i] + 8;
+            if (strcmp(table_str, "DENSE") == 0) {
+                table_type = TABLE_DENSE;
+            } else if (strcmp(table_str, "HASH") == 0) {
+                table_type = TABLE_HASH;
+            } else {
+                fprintf(stderr, "Invalid table type: %s\n", table_str);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            num_threads = atoi(argv[i] + 10);
+            if (num_threads < 1 || num_threads > NUM_THREADS) {
+                fprintf(stderr, "Invalid thread count: %s\n", argv[i] + 10);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--alphas=", 9) == 0) {
+            num_alphas = parse_list(argv[i] + 9, alphas, MAX_SWEEP_CONFIGS);
+        } else if (strncmp(argv[i], "--gammas=", 9) == 0) {
+            num_gammas = parse_list(argv[i] + 9, gammas, MAX_SWEEP_CONFIGS);
+        } else if (strncmp(argv[i], "--epsilons=", 11) == 0) {
+            num_epsilons = parse_list(argv[i] + 11, epsilons, MAX_SWEEP_CONFIGS);
+        } else if (strncmp(argv[i], "--lambda=", 9) == 0) {
+            lambda = atof(argv[i] + 9);
+        } else if (strncmp(argv[i], "--trace-cutoff=", 15) == 0) {
+            trace_cutoff = atof(argv[i] + 15);
+        } else if (strncmp(argv[i], "--tol=", 6) == 0) {
+            convergence_tol = atof(argv[i] + 6);
+        } else if (strncmp(argv[i], "--print=", 8) == 0) {
+            char *print_str = argv[i] + 8;
+            if (strcmp(print_str, "ALL") == 0) {
+                print_type = PRINT_ALL;
+            } else if (strcmp(print_str, "MERGED") == 0) {
+                print_type = PRINT_MERGED;
+            } else if (strcmp(print_str, "GREEDY") == 0) {
+                print_type = PRINT_GREEDY;
+            } else if (strcmp(print_str, "NONE") == 0) {
+                print_type = PRINT_NONE;
+            } else {
+                fprintf(stderr, "Invalid print mode: %s\n", print_str);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--policy=", 9) == 0) {
+            policy_path = argv[i] + 9;
+        } else if (strncmp(argv[i], "--evaluate=", 11) == 0) {
+            eval_episodes = atoi(argv[i] + 11);
+            if (eval_episodes < 1) {
+                fprintf(stderr, "Invalid evaluation episode count: %s\n", argv[i] + 11);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--eval-env=", 11) == 0) {
+            char *env_str = argv[i] + 11;
+            if (strcmp(env_str, "MODEL") == 0) {
+                eval_env_type = EVAL_MODEL;
+            } else if (strcmp(env_str, "FROZENLAKE4X4") == 0) {
+                eval_env_type = EVAL_FROZENLAKE4X4;
+            } else if (strcmp(env_str, "FROZENLAKE8X8") == 0) {
+                eval_env_type = EVAL_FROZENLAKE8X8;
+            } else if (strcmp(env_str, "TAXI") == 0) {
+                eval_env_type = EVAL_TAXI;
+            } else {
+                fprintf(stderr, "Invalid evaluation environment: %s\n", env_str);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--eval-horizon=", 15) == 0) {
+            eval_horizon = atoi(argv[i] + 15);
+            if (eval_horizon < 1) {
+                fprintf(stderr, "Invalid evaluation horizon: %s\n", argv[i] + 15);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--eval-seed=", 12) == 0) {
+            eval_seed = strtoull(argv[i] + 12, NULL, 10);
+        } else if (strncmp(argv[i], "--eval-slippery=", 16) == 0) {
+            eval_slippery = atoi(argv[i] + 16) != 0;
+        } else if (strncmp(argv[i], "--checkpoint=", 13) == 0) {
+            checkpoint_path = argv[i] + 13;
+        } else if (strncmp(argv[i], "--report=", 9) == 0) {
+            report_path = argv[i] + 9;
+        } else if (strncmp(argv[i], "--report-format=", 16) == 0) {
+            char *format_str = argv[i] + 16;
+            if (strcmp(format_str, "JSON") == 0) {
+                report_type = REPORT_JSON;
+            } else if (strcmp(format_str, "CSV") == 0) {
+                report_type = REPORT_CSV;
+            } else {
+                fprintf(stderr, "Invalid report format: %s\n", format_str);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--state-file=", 13) == 0) {
+            state_path = argv[i] + 13;
+        } else if (strncmp(argv[i], "--save-every=", 13) == 0) {
+            save_every = atoi(argv[i] + 13);
+            if (save_every < 1) {
+                fprintf(stderr, "Invalid snapshot interval: %s\n", argv[i] + 13);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            resume = 1;
+        } else if (strncmp(argv[i], "--publish=", 10) == 0) {
+            publish_path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--publish-every=", 16) == 0) {
+            publish_every = atoi(argv[i] + 16);
+            if (publish_every < 1) {
+                fprintf(stderr, "Invalid publish interval: %s\n", argv[i] + 16);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+            stats_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            trace_path = argv[i] + 8;
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            perf_enabled = 1;
+        } else if (strncmp(argv[i], "--actions=", 10) == 0) {
+            actions_source = argv[i] + 10;
+        } else if (strncmp(argv[i], "--fixed=", 8) == 0) {
+            char *end;
+            fixed_width = (int)strtol(argv[i] + 8, &end, 10);
+            fixed_frac = *end == ':' ? atoi(end + 1) : -1;
+            if ((fixed_width != 16 && fixed_width != 32) || fixed_frac < 0 || fixed_frac > fixed_width - 2) {
+                fprintf(stderr, "Invalid fixed-point format: %s (16:<F> or 32:<F>, F fraction bits)\n", argv[i] + 8);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--fixed-check") == 0) {
+            fixed_check = 1;
+        } else if (strcmp(argv[i], "--renumber") == 0) {
+            renumber_states = 1;
+        } else if (strncmp(argv[i], "--episodes=", 11) == 0) {
+            num_episodes = atoi(argv[i] + 11);
+            if (num_episodes < 1) {
+                fprintf(stderr, "Invalid episode count: %s\n", argv[i] + 11);
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--patience=", 11) == 0) {
+            convergence_patience = atoi(argv[i] + 11);
+            if (convergence_patience < 1) {
+                fprintf(stderr, "Invalid patience: %s\n", argv[i] + 11);
+                return EXIT_FAILURE;
+            }
+        } else {
+            fprintf(stderr, "Invalid option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (num_actions < 1 || num_actions > NUM_ACTIONS || num_states < 1 ||
+        (num_states > NUM_STATES && engine_type != MODEL && engine_type != PSWEEP && table_type == TABLE_DENSE)) {
+        fprintf(stderr, "Table size %d x %d exceeds NUM_STATES x NUM_ACTIONS (%d x %d)\n", num_states, num_actions, NUM_STATES, NUM_ACTIONS);
+        return EXIT_FAILURE;
+    }
+    if (num_alphas < 1 || num_gammas < 1 || num_epsilons < 1 ||
+        num_alphas * num_gammas * num_epsilons > MAX_SWEEP_CONFIGS) {
+        fprintf(stderr, "Invalid sweep grid (at most %d configurations)\n", MAX_SWEEP_CONFIGS);
+        return EXIT_FAILURE;
+    }
+    num_configs = 0;
+    for (int a = 0; a < num_alphas; a++) {
+        for (int g = 0; g < num_gammas; g++) {
+            for (int e = 0; e < num_epsilons; e++) {
+                sweep_alpha[num_configs] = alphas[a];
+                sweep_gamma[num_configs] = gammas[g];
+                sweep_epsilon[num_configs] = epsilons[e];
+                num_configs++;
+            }
+        }
+    }
+    config_stride = (num_configs + SWEEP_LANES - 1) / SWEEP_LANES * SWEEP_LANES;
+    for (int c = num_configs; c < config_stride; c++) {
+        sweep_alpha[c] = 0.0;
+        sweep_gamma[c] = 0.0;
+        sweep_epsilon[c] = 0.0;
+    }
+    if (engine_type == SWEEP && (algorithm_type > SARSA || update_type != ONLINE || convergence_tol > 0)) {
+        fprintf(stderr, "The SWEEP engine supports QLEARN/SARSA with --update=ONLINE and no --tol\n");
+        return EXIT_FAILURE;
+    }
+
+    if (table_type == TABLE_HASH &&
+        (engine_type != SAMPLE || (algorithm_type != QLEARN && algorithm_type != SARSA && algorithm_type != SARSALOGGED) ||
+         update_type != ONLINE || convergence_tol > 0 || state_path != NULL || resume || publish_path != NULL ||
+         checkpoint_path != NULL)) {
+        fprintf(stderr, "--table=HASH supports the SAMPLE engine with QLEARN/SARSA/SARSALOGGED, --update=ONLINE and no\n");
+        fprintf(stderr, "--tol, --state-file, --publish or --checkpoint\n");
+        return EXIT_FAILURE;
+    }
+    if ((state_path != NULL || resume) && (engine_type == MODEL || engine_type == PSWEEP)) {
+        fprintf(stderr, "Training state snapshots only apply to the SAMPLE and SWEEP engines\n");
+        return EXIT_FAILURE;
+    }
+    if (actions_source != NULL &&
+        (engine_type != SAMPLE || (algorithm_type != QLEARN && algorithm_type != SARSA && algorithm_type != SARSALOGGED) ||
+         update_type != ONLINE || table_type != TABLE_DENSE || convergence_tol > 0 || state_path != NULL || resume ||
+         publish_path != NULL)) {
+        fprintf(stderr, "--actions supports the SAMPLE engine with QLEARN/SARSA/SARSALOGGED, --update=ONLINE and no\n");
+        fprintf(stderr, "--table=HASH, --tol, --state-file or --publish\n");
+        return EXIT_FAILURE;
+    }
+    if (fixed_width > 0 &&
+        (engine_type != SAMPLE || (algorithm_type != QLEARN && algorithm_type != SARSA && algorithm_type != SARSALOGGED) ||
+         update_type != ONLINE || table_type != TABLE_DENSE || actions_source != NULL || convergence_tol > 0 ||
+         state_path != NULL || resume || publish_path != NULL)) {
+        fprintf(stderr, "--fixed supports the SAMPLE engine with QLEARN/SARSA/SARSALOGGED, --update=ONLINE and no\n");
+        fprintf(stderr, "--table=HASH, --actions, --tol, --state-file or --publish\n");
+        return EXIT_FAILURE;
+    }
+    if (fixed_check && fixed_width == 0) {
+        fprintf(stderr, "--fixed-check needs --fixed=<format>\n");
+        return EXIT_FAILURE;
+    }
+    if (renumber_states && (engine_type == MODEL || engine_type == PSWEEP)) {
+        fprintf(stderr, "State renumbering only applies to the SAMPLE and SWEEP engines\n");
+        return EXIT_FAILURE;
+    }
+    if (stats_path != NULL && (engine_type == MODEL || engine_type == PSWEEP)) {
+        fprintf(stderr, "Live statistics only apply to the SAMPLE and SWEEP engines\n");
+        return EXIT_FAILURE;
+    }
+    if (perf_enabled && (engine_type == MODEL || engine_type == PSWEEP)) {
+        fprintf(stderr, "Hardware counters only apply to the SAMPLE and SWEEP engines\n");
+        return EXIT_FAILURE;
+    }
+    int eval_states[] = { 0, 16, 64, QENV_TAXI_STATES }, eval_actions[] = { 0, 4, 4, QENV_TAXI_ACTIONS };
+    if (eval_episodes > 0 && eval_env_type != EVAL_MODEL &&
+        (num_states != eval_states[eval_env_type] || num_actions != eval_actions[eval_env_type])) {
+        fprintf(stderr, "This evaluation environment needs a %d x %d table\n", eval_states[eval_env_type], eval_actions[eval_env_type]);
+        return EXIT_FAILURE;
+    }
+    if (publish_path != NULL && (engine_type == MODEL || engine_type == PSWEEP)) {
+        fprintf(stderr, "Table publishing only applies to the SAMPLE and SWEEP engines\n");
+        return EXIT_FAILURE;
+    }
+    if (resume && state_path == NULL) {
+        fprintf(stderr, "--resume needs --state-file=<path>\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((algorithm_type == QLAMBDA || algorithm_type == SARSALAMBDA) && update_type != ONLINE) {
+        fprintf(stderr, "Eligibility traces require --update=ONLINE\n");
+        return EXIT_FAILURE;
+    }
+    // Traces only run forward through a trajectory; BACKWARD would clear them
+    // before every sample and quietly turn lambda into a one-step update
+    if ((algorithm_type == QLAMBDA || algorithm_type == SARSALAMBDA) && sampling_type == BACKWARD) {
+        fprintf(stderr, "Eligibility traces cannot be used with BACKWARD sampling\n");
+        return EXIT_FAILURE;
+    }
+
     // Your program logic goes here, using the extracted variables
 
     // Print the extracted values for demonstration purposes
@@ -220,8 +3844,30 @@ int main(int argc, char *argv[]) {
     printf("Num Samples: %d\n", num_samples);
     printf("Sampling Type: %d\n", sampling_type);
     printf("Algorithm Type: %d\n", algorithm_type);
+    printf("Update Mode: %d\n", update_type);
+    printf("Engine: %d\n", engine_type);
+    printf("Threads: %d\n", num_threads);
+    if (engine_type == SWEEP)
+        printf("Sweep Configurations: %d\n", num_configs);
+    if (table_type == TABLE_HASH)
+        printf("Table: HASH\n");
+    if (fixed_width > 0)
+        printf("Fixed Point: %d-bit, %d fraction bits\n", fixed_width, fixed_frac);
+    if (convergence_tol > 0)
+        printf("Convergence Tolerance: %g (patience %d)\n", convergence_tol, convergence_patience);
 
-    // clock_t start_time = clock();
+    struct timespec run_start, phase_start;
+    clock_gettime(CLOCK_MONOTONIC, &run_start);
+    phase_start = run_start;
+    trace_origin = run_start;
+    if (trace_path != NULL) {
+        main_trace.events = (TraceEvent*)malloc(TRACE_RING_EVENTS * sizeof(TraceEvent));
+        if (main_trace.events == NULL) {
+            perror("Error allocating memory for the trace");
+            return 1;
+        }
+    }
+    uint64_t trace_start = trace_begin(&main_trace);
 
     FILE *file = fopen(filepath, "r");
     if (file == NULL) {
@@ -238,25 +3884,113 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    Experience experience;
-    
-    int num_s = 0;
-    while (num_s < num_samples && fscanf(file, "%d %d %lf %d", &experience.state, &experience.action, &experience.reward, &experience.next_state) != EOF) {
-        dataset[num_s] = experience;
-        num_s++;
+    char magic[sizeof(((QExperienceHeader*)0)->magic)];
+    int max_samples = num_samples < BATCH_CAPACITY ? num_samples : BATCH_CAPACITY;
+    int num_s;
+    if (fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, QEXP_MAGIC, sizeof(magic)) == 0) {
+        num_s = load_binary_dataset(file, dataset, max_samples);
+    } else {
+        rewind(file);
+        num_s = load_dataset(file, dataset, max_samples);
     }
-
     fclose(file);
+    if (num_s < 0) {
+        free(dataset);
+        return 1;
+    }
+    printf("Loaded %d samples in %d trajectories\n", num_s, num_trajectories);
+    if (algorithm_type == SARSALOGGED && num_logged_actions == 0) {
+        fprintf(stderr, "SARSALOGGED needs the 5-field format: state action reward next_state next_action\n");
+        free(dataset);
+        free(traj_offsets);
+        return 1;
+    }
+    // Sparse tables are keyed by state and renumbering and action sets index
+    // by it, so out-of-range samples cannot just land in some other row
+    for (int i = 0; (table_type == TABLE_HASH || renumber_states || actions_source != NULL) && i < num_s; i++) {
+        Experience e = dataset[i];
+        if (e.state < 0 || e.state >= num_states || e.next_state < 0 || e.next_state >= num_states ||
+            e.action < 0 || e.action >= num_actions) {
+            fprintf(stderr, "Sample %d is outside the %d x %d table\n", i, num_states, num_actions);
+            free(dataset);
+            free(traj_offsets);
+            return 1;
+        }
+    }
+    if (renumber_states) {
+        if (renumber_dataset(dataset, num_s) != 0) {
+            free(dataset);
+            free(traj_offsets);
+            return 1;
+        }
+        printf("Renumbered %d visited states (of %d) by visit count\n", visited_states, num_states);
+    }
+    if (actions_source != NULL) {
+        if (index_dataset_actions(dataset, num_s) != 0) {
+            free(dataset);
+            free(traj_offsets);
+            return 1;
+        }
+        printf("Action sets: %d of %d (s,a) pairs\n", action_offsets[num_states], num_states * num_actions);
+    }
+    if (fixed_width > 0) {
+        fixed_alpha = llround(ldexp(ALPHA, FIXED_COEFF_BITS));
+        fixed_gamma = llround(ldexp(GAMMA, FIXED_COEFF_BITS));
+        fixed_rewards = (int32_t*)malloc((num_s + 1) * sizeof(int32_t));
+        if (fixed_rewards == NULL) {
+            perror("Error allocating memory for fixed-point rewards");
+            free(dataset);
+            free(traj_offsets);
+            return 1;
+        }
+        double limit = fixed_width == 16 ? INT16_MAX : INT32_MAX;
+        int saturated = 0;
+        for (int i = 0; i < num_s; i++) {
+            double reward = nearbyint(ldexp(dataset[i].reward, fixed_frac));
+            if (fabs(reward) > limit) {
+                reward = reward > 0 ? limit : -limit;
+                saturated++;
+            }
+            fixed_rewards[i] = (int32_t)reward;
+        }
+        if (saturated > 0)
+            fprintf(stderr, "Warning: %d rewards saturated in the fixed-point format\n", saturated);
+    }
+
+    phase_seconds[PHASE_LOAD] = seconds_since(phase_start);
+    trace_end(&main_trace, PHASE_LOAD, trace_start, -1);
+    clock_gettime(CLOCK_MONOTONIC, &phase_start);
+    trace_start = trace_begin(&main_trace);
+
+    if (engine_type == MODEL || engine_type == PSWEEP) {
+        int status = engine_type == MODEL ? run_model_engine(dataset, num_s) : run_psweep_engine(dataset, num_s);
+        free(dataset);
+        free(traj_offsets);
+        if (status == 0 && report_path != NULL)
+            status = write_report(filepath, sampling_str, algorithm_str, num_s, seconds_since(run_start), NULL, 0);
+        if (status == 0 && trace_path != NULL)
+            status = write_trace(NULL, 0);
+        free(main_trace.events);
+        return status;
+    }
 
-    // Divide the dataset into chunks
-    int chunk_size = num_samples / NUM_THREADS;
+    // Divide the dataset into chunks. The file may hold fewer samples than
+    // were asked for, so split what was loaded: rows past num_s were never
+    // read, range-checked, renumbered or given fixed-point rewards.
+    int chunk_size = num_s / num_threads;
     pthread_t threads[NUM_THREADS];
     ThreadData thread_data[NUM_THREADS];
 
     // Initialize Q-tables for each thread
     double q_tables[NUM_THREADS][NUM_STATES][NUM_ACTIONS];
+    QHash hash_tables[NUM_THREADS];
+    uint64_t* seen_states = NULL;  // Scratch bitmap for sizing the hash tables
+    if (table_type == TABLE_HASH && (seen_states = (uint64_t*)calloc(num_states / 64 + 1, sizeof(uint64_t))) == NULL) {
+        perror("Error allocating memory for sparse Q-tables");
+        return 1;
+    }
 
-    for (int i = 0; i < NUM_THREADS; i++) {
+    for (int i = 0; i < num_threads && table_type == TABLE_DENSE; i++) {
         for (int state = 0; state < num_states; state++) {
             for (int action = 0; action < num_actions; action++) {
                 q_tables[i][state][action] = 0.0;
@@ -264,7 +3998,37 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    clock_t start_time = clock();
+    QStateHeader* resume_state = NULL;
+    if (resume) {
+        resume_state = load_training_state(num_samples);
+        if (resume_state == NULL) {
+            free(dataset);
+            free(traj_offsets);
+            return 1;
+        }
+        converged_streak = resume_state->converged_streak;
+        last_delta_max = resume_state->last_delta_max;
+        last_delta_mean = resume_state->last_delta_mean;
+        printf("Resuming after episode %d from %s\n", resume_state->episode, state_path);
+    }
+    pthread_t snapshot_writer;
+    if (state_path != NULL && start_snapshots(num_samples, &snapshot_writer) != 0)
+        return 1;
+    if (stats_path != NULL && open_stats_page(num_s) != 0)
+        return 1;
+    if (publish_path != NULL && open_publish_page() != 0)
+        return 1;
+
+    phase_seconds[PHASE_INIT] = seconds_since(phase_start);
+    trace_end(&main_trace, PHASE_INIT, trace_start, -1);
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    trace_start = trace_begin(&main_trace);
+
+    all_thread_data = thread_data;
+    episodes_run = num_episodes;
+    if (convergence_tol > 0)
+        pthread_barrier_init(&episode_barrier, NULL, num_threads);
 
     void* (*update_q_table_thread_func)(void*);
 
@@ -279,57 +4043,471 @@ int main(int argc, char *argv[]) {
         case STRIDE:
             update_q_table_thread_func = update_stride_thread;
             break;
+        case BACKWARD:
+            update_q_table_thread_func = update_backward_thread;
+            break;
         default:
             fprintf(stderr, "Invalid sampling type\n");
             return -1;
     }
 
 
+    // BACKWARD hands out whole trajectories, balanced by sample count
+    int traj_bounds[NUM_THREADS + 1];
+    traj_bounds[0] = 0;
+    for (int t = 1; t < num_threads; t++) {
+        long target = (long)num_s * t / num_threads;
+        int traj = traj_bounds[t - 1];
+        while (traj < num_trajectories && traj_offsets[traj] < target)
+            traj++;
+        traj_bounds[t] = traj;
+    }
+    traj_bounds[num_threads] = num_trajectories;
+
     // Create threads and perform Q-learning updates in parallel - sequential
     
-    for (int batch_window = 0; batch_window < NUM_THREADS; batch_window++) {
+    for (int batch_window = 0; batch_window < num_threads; batch_window++) {
         
                 thread_data[batch_window].dataset = dataset;
+                thread_data[batch_window].thread_id = batch_window;
+                thread_data[batch_window].delta_max = 0.0;
+                thread_data[batch_window].delta_sum = 0.0;
+                thread_data[batch_window].delta_count = 0;
+                thread_data[batch_window].converged_streak = 0;
+                thread_data[batch_window].converged_episode = -1;
+                thread_data[batch_window].prev_q_table = NULL;
+                if (convergence_tol > 0) {
+                    thread_data[batch_window].prev_q_table = malloc(NUM_STATES * sizeof(double[NUM_ACTIONS]));
+                    if (thread_data[batch_window].prev_q_table == NULL) {
+                        perror("Error allocating memory for convergence tracking");
+                        return 1;
+                    }
+                    memcpy(thread_data[batch_window].prev_q_table, q_tables[batch_window], NUM_STATES * sizeof(double[NUM_ACTIONS]));
+                }
                 thread_data[batch_window].start_index =  batch_window * chunk_size;
                 thread_data[batch_window].end_index = (batch_window + 1) * chunk_size;
+                thread_data[batch_window].traj_start = traj_bounds[batch_window];
+                thread_data[batch_window].traj_end = traj_bounds[batch_window + 1];
+                if (sampling_type == BACKWARD) {
+                    thread_data[batch_window].start_index = traj_offsets[traj_bounds[batch_window]];
+                    thread_data[batch_window].end_index = traj_offsets[traj_bounds[batch_window + 1]];
+                }
                 thread_data[batch_window].q_table = q_tables[batch_window];
+                thread_data[batch_window].sweep_table = NULL;
+                thread_data[batch_window].hash_table = NULL;
+                thread_data[batch_window].ragged_table = NULL;
+                thread_data[batch_window].fixed_table = NULL;
+                thread_data[batch_window].saturations = 0;
+                thread_data[batch_window].check_seed = 42;
+                if (fixed_width > 0) {
+                    thread_data[batch_window].fixed_table = calloc((size_t)num_states * num_actions, fixed_width / 8);
+                    if (thread_data[batch_window].fixed_table == NULL) {
+                        perror("Error allocating memory for fixed-point Q-tables");
+                        return 1;
+                    }
+                }
+                if (action_offsets != NULL) {
+                    thread_data[batch_window].ragged_table = (double*)calloc(action_offsets[num_states] + 1, sizeof(double));
+                    if (thread_data[batch_window].ragged_table == NULL) {
+                        perror("Error allocating memory for ragged Q-tables");
+                        return 1;
+                    }
+                }
+                if (table_type == TABLE_HASH) {
+                    long rows = count_thread_states(&thread_data[batch_window], seen_states);
+                    if (qhash_init(&hash_tables[batch_window], rows, num_actions) != 0) {
+                        perror("Error allocating memory for sparse Q-tables");
+                        return 1;
+                    }
+                    thread_data[batch_window].hash_table = &hash_tables[batch_window];
+                }
+                if (engine_type == SWEEP) {
+                    thread_data[batch_window].sweep_table = (double*)calloc((size_t)num_states * NUM_ACTIONS * config_stride, sizeof(double));
+                    if (thread_data[batch_window].sweep_table == NULL) {
+                        perror("Error allocating memory for sweep tables");
+                        return 1;
+                    }
+                }
+                thread_data[batch_window].batch_len = 0;
+                thread_data[batch_window].trace_len = 0;
+                thread_data[batch_window].last_index = -2;
+                thread_data[batch_window].trace_end = 0;
+                thread_data[batch_window].seed = 42;
+                thread_data[batch_window].rand_seed = 42;
+                thread_data[batch_window].start_episode = 0;
+                thread_data[batch_window].pass_samples = thread_data[batch_window].end_index - thread_data[batch_window].start_index;
+                if (sampling_type == STRIDE)
+                    thread_data[batch_window].pass_samples = thread_data[batch_window].pass_samples / NUM_STRIDE * NUM_STRIDE;
+                thread_data[batch_window].updates = 0;
+                thread_data[batch_window].cpu_seconds = 0.0;
+                thread_data[batch_window].wall_seconds = 0.0;
+                thread_data[batch_window].episodes_timed = 0;
+                thread_data[batch_window].episode_min = 0.0;
+                thread_data[batch_window].episode_max = 0.0;
+                thread_data[batch_window].episode_sum = 0.0;
+                memset(thread_data[batch_window].episode_hist, 0, sizeof(thread_data[batch_window].episode_hist));
+                for (int c = 0; c < NUM_COUNTERS; c++) {
+                    thread_data[batch_window].perf_fds[c] = -1;
+                    thread_data[batch_window].counters[c] = -1;
+                }
+                thread_data[batch_window].trace.events = NULL;
+                thread_data[batch_window].trace.written = 0;
+                if (trace_path != NULL) {
+                    thread_data[batch_window].trace.events = (TraceEvent*)malloc(TRACE_RING_EVENTS * sizeof(TraceEvent));
+                    if (thread_data[batch_window].trace.events == NULL) {
+                        perror("Error allocating memory for the trace");
+                        return 1;
+                    }
+                }
+                if (update_type != ONLINE) {
+                    thread_data[batch_window].batch_indices = (int*)malloc(BATCH_SIZE * sizeof(int));
+                    thread_data[batch_window].batch_slots = (int*)malloc(BATCH_SIZE * sizeof(int));
+                    thread_data[batch_window].batch_td = (double*)malloc(BATCH_SIZE * sizeof(double));
+                    thread_data[batch_window].batch_delta = (double*)calloc(NUM_STATES * NUM_ACTIONS, sizeof(double));
+                    thread_data[batch_window].batch_count = (int*)calloc(NUM_STATES * NUM_ACTIONS, sizeof(int));
+                    thread_data[batch_window].batch_touched = (int*)malloc(BATCH_SIZE * sizeof(int));
+                    if (thread_data[batch_window].batch_indices == NULL || thread_data[batch_window].batch_slots == NULL ||
+                        thread_data[batch_window].batch_td == NULL || thread_data[batch_window].batch_delta == NULL ||
+                        thread_data[batch_window].batch_count == NULL || thread_data[batch_window].batch_touched == NULL) {
+                        perror("Error allocating memory for mini-batch");
+                        return 1;
+                    }
+                }
                 
+                if (resume_state != NULL)
+                    restore_thread_state(resume_state, &thread_data[batch_window]);
+                init_thread_stats(&thread_data[batch_window]);
+
                 pthread_create (&threads[batch_window], NULL, update_q_table_thread_func, (void*)&thread_data[batch_window]);
                 //update_q_table(dataset[i], q_tables[batch_window]);    
     }
 
 
+    free(seen_states);
+
     // Join threads to wait for their completion
-    for (int batch_window = 0; batch_window < NUM_THREADS; batch_window++) {
+    for (int batch_window = 0; batch_window < num_threads; batch_window++) {
         pthread_join(threads[batch_window], NULL);
     }
 
-    clock_t end_time = clock();
-    double total_time_taken = ((double)(end_time - start_time)) / CLOCKS_PER_SEC;
+    double total_time_taken = seconds_since(start_time);
+    phase_seconds[PHASE_TRAIN] = total_time_taken;
+    trace_end(&main_trace, PHASE_TRAIN, trace_start, -1);
 
-    // Print Q-tables for each thread
-    for (int i = 0; i < NUM_THREADS; i++) {
-        printf("Q-table for Thread %d:\n", i);
-        for (int state = 0; state < num_states; state++) {
-            for (int action = 0; action < num_actions; action++) {
+    if (convergence_tol > 0)
+        pthread_barrier_destroy(&episode_barrier);
+    if (state_path != NULL)
+        stop_snapshots(snapshot_writer);
+    if (stats_page != NULL)
+        close_stats_page();
+    if (publish_page != NULL) {
+        const double* tables[NUM_THREADS];
+        for (int i = 0; i < num_threads; i++)
+            tables[i] = thread_data[i].sweep_table != NULL ? thread_data[i].sweep_table : &q_tables[i][0][0];
+        publish_merged(tables, episodes_run - 1);
+        close_publish_page();
+    }
+    free(resume_state);
+    clock_gettime(CLOCK_MONOTONIC, &phase_start);
+    trace_start = trace_begin(&main_trace);
 
-                printf("Q(%d, %d) = %f\n", state, action, q_tables[i][state][action]);
+    // The fixed-point tables are what the run reports
+    if (fixed_width > 0) {
+        report_fixed_point(thread_data, num_threads);
+        for (int i = 0; i < num_threads; i++) {
+            for (int state = 0; state < num_states; state++) {
+                for (int action = 0; action < num_actions; action++)
+                    q_tables[i][state][action] = fixed_value(thread_data[i].fixed_table, state, action);
             }
         }
-        printf("\n");
     }
 
+    // Back to the original actions and state IDs for everything that follows;
+    // ragged tables are spread over the dense ones, and the hash tables are
+    // relabelled as they are reported
+    if (action_sets != NULL) {
+        restore_dataset_actions(dataset, num_s);
+        for (int i = 0; i < num_threads; i++)
+            expand_ragged_table(thread_data[i].ragged_table, q_tables[i]);
+    }
+    if (state_ids != NULL) {
+        run_renumber_jobs(relabel_states_thread, dataset, num_s, NULL, state_ids);
+        for (int i = 0; i < num_threads && table_type == TABLE_DENSE; i++) {
+            double* table = thread_data[i].sweep_table != NULL ? thread_data[i].sweep_table : &q_tables[i][0][0];
+            size_t row_doubles = thread_data[i].sweep_table != NULL ? (size_t)NUM_ACTIONS * config_stride : NUM_ACTIONS;
+            if (restore_state_order(table, row_doubles) != 0)
+                return 1;
+        }
+    }
+
+    // Print Q-tables for each configuration and thread, and collect them for --checkpoint
+    int report_configs = engine_type == SWEEP ? num_configs : 1;
+    QTableHeader* checkpoint = NULL;
+    if (checkpoint_path != NULL && (checkpoint = new_checkpoint(num_threads, report_configs, 1)) == NULL)
+        return 1;
+    QPolicyHeader* policy = NULL;
+    if ((policy_path != NULL || eval_episodes > 0) && (policy = new_policy(report_configs)) == NULL)
+        return 1;
+    if (table_type == TABLE_HASH && report_hash_tables(hash_tables, num_threads, policy) != 0) {
+        free(policy);
+        return 1;
+    }
+    for (int c = 0; c < report_configs && table_type == TABLE_DENSE; c++) {
+        const double* tables[NUM_THREADS];
+        char label[128] = "";
+        size_t row_stride = NUM_ACTIONS, col_stride = 1;
+        for (int i = 0; i < num_threads; i++)
+            tables[i] = &q_tables[i][0][0];
+        if (engine_type == SWEEP) {
+            snprintf(label, sizeof(label), "Config %d (alpha=%g, gamma=%g, epsilon=%g)", c, sweep_alpha[c], sweep_gamma[c], sweep_epsilon[c]);
+            row_stride = (size_t)NUM_ACTIONS * config_stride;
+            col_stride = config_stride;
+            for (int i = 0; i < num_threads; i++)
+                tables[i] = thread_data[i].sweep_table + c;
+        }
+        double* payload = NULL;
+        if (checkpoint != NULL)
+            payload = qtable_data(checkpoint) + (size_t)c * (num_threads + 1) * num_states * num_actions;
+        if (report_q_tables(label, tables, num_threads, row_stride, col_stride, payload, policy, c) != 0) {
+            free(checkpoint);
+            free(policy);
+            return 1;
+        }
+    }
+    if (policy_path != NULL && write_policy(policy_path, policy) != 0) {
+        free(checkpoint);
+        free(policy);
+        return 1;
+    }
+    if (checkpoint != NULL) {
+        int status = write_checkpoint(checkpoint_path, checkpoint);
+        free(checkpoint);
+        if (status != 0) {
+            free(policy);
+            return 1;
+        }
+    }
+    phase_seconds[PHASE_OUTPUT] = seconds_since(phase_start) - phase_seconds[PHASE_MERGE];
+    trace_end(&main_trace, PHASE_OUTPUT, trace_start, -1);
+
+    if (eval_episodes > 0 && evaluate_policies(policy, dataset, num_s, NULL) != 0) {
+        free(policy);
+        return 1;
+    }
+    free(policy);
+
     // Free allocated memory for the dataset
     free(dataset);
+    free(traj_offsets);
+    free(state_ids);
+    free(state_ranks);
+    free(action_offsets);
+    free(action_sets);
+    free(fixed_rewards);
+    for (int i = 0; i < num_threads; i++) {
+        free(thread_data[i].prev_q_table);
+        free(thread_data[i].sweep_table);
+        free(thread_data[i].ragged_table);
+        free(thread_data[i].fixed_table);
+        if (thread_data[i].hash_table != NULL)
+            qhash_free(thread_data[i].hash_table);
+    }
+    if (update_type != ONLINE) {
+        for (int i = 0; i < num_threads; i++) {
+            free(thread_data[i].batch_indices);
+            free(thread_data[i].batch_slots);
+            free(thread_data[i].batch_td);
+            free(thread_data[i].batch_delta);
+            free(thread_data[i].batch_count);
+            free(thread_data[i].batch_touched);
+        }
+    }
 
-    // clock_t end_time = clock();
-    // double total_time_taken = ((double)(end_time - start_time)) / CLOCKS_PER_SEC;
+    if (convergence_tol > 0) {
+        if (converged_episode >= 0)
+            printf("Converged at episode %d (max |dQ| < %g for %d episodes)\n", converged_episode, convergence_tol, convergence_patience);
+        else
+            printf("Did not converge within %d episodes\n", num_episodes);
+        printf("Episodes run: %d, last max |dQ| = %g, last mean |dQ| = %g\n", episodes_run, last_delta_max, last_delta_mean);
+        for (int i = 0; i < num_threads; i++) {
+            if (thread_data[i].converged_episode >= 0)
+                printf("Thread %d converged at episode %d\n", i, thread_data[i].converged_episode);
+            else
+                printf("Thread %d did not converge\n", i);
+        }
+    }
 
     printf("Total time taken for Q-learning updates: %f seconds\n", total_time_taken);
+    if (perf_enabled)
+        print_counters(thread_data, num_threads);
+
+    if (report_path != NULL &&
+        write_report(filepath, sampling_str, algorithm_str, num_s, seconds_since(run_start), thread_data, num_threads) != 0)
+        return 1;
+    if (trace_path != NULL) {
+        int status = write_trace(thread_data, num_threads);
+        free(main_trace.events);
+        for (int i = 0; i < num_threads; i++)
+            free(thread_data[i].trace.events);
+        if (status != 0)
+            return 1;
+    }
 
     return 0;
 }
 
 
+// Manifest mode: every non-empty line not starting with '#' is one job,
+//   <filepath> <num_states> <num_actions> <num_samples> <sampling> <algorithm> <output_path> [options]
+// Jobs run as child processes sharing one pool of online cores: small jobs get
+// a single thread so many run side by side, large ones get up to NUM_THREADS.
+// Each job writes its normal output to its own output_path.
+typedef struct {
+    char line[1024];            // Owns the strings argv points into
+    char threads_arg[32];
+    int argc;
+    char* argv[MAX_JOB_ARGS];
+    char* output_path;
+    int threads;
+    pid_t pid;
+    int status;
+    struct timespec start;
+    double seconds;
+} Job;
+
+int run_manifest(char* program, char* manifest_path, int extra_argc, char* extra_argv[]) {
+    FILE* manifest = fopen(manifest_path, "r");
+    if (manifest == NULL) {
+        perror("Error opening the manifest");
+        return 1;
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1)
+        cores = 1;
+
+    Job* jobs = (Job*)calloc(MAX_JOBS, sizeof(Job));
+    if (jobs == NULL) {
+        perror("Error allocating memory for jobs");
+        fclose(manifest);
+        return 1;
+    }
+
+    int num_jobs = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), manifest) != NULL) {
+        char* p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+            continue;
+        if (num_jobs == MAX_JOBS) {
+            fprintf(stderr, "Manifest has more than %d jobs\n", MAX_JOBS);
+            break;
+        }
+
+        Job* job = &jobs[num_jobs];
+        strcpy(job->line, p);
+        char* tokens[MAX_JOB_ARGS];
+        int num_tokens = 0;
+        for (char* tok = strtok(job->line, " \t\r\n"); tok != NULL && num_tokens < MAX_JOB_ARGS; tok = strtok(NULL, " \t\r\n"))
+            tokens[num_tokens++] = tok;
+        if (num_tokens < 7 || num_tokens - 1 + extra_argc + 2 > MAX_JOB_ARGS) {
+            fprintf(stderr, "Skipping malformed job: %s", p);
+            continue;
+        }
+
+        // Small jobs: job-level parallelism; large jobs: intra-job threads
+        int samples = atoi(tokens[3]);
+        job->threads = samples < SMALL_JOB_SAMPLES ? 1 : (cores < NUM_THREADS ? (int)cores : NUM_THREADS);
+        snprintf(job->threads_arg, sizeof(job->threads_arg), "--threads=%d", job->threads);
+
+        job->output_path = tokens[6];
+        job->argc = 0;
+        job->argv[job->argc++] = program;
+        for (int k = 0; k < 6; k++)
+            job->argv[job->argc++] = tokens[k];
+        job->argv[job->argc++] = job->threads_arg;
+        // The last --threads= wins in run_job: job line, then extra options, then the default
+        for (int k = 0; k < extra_argc; k++) {
+            if (strncmp(extra_argv[k], "--threads=", 10) == 0)
+                job->threads = atoi(extra_argv[k] + 10);
+            job->argv[job->argc++] = extra_argv[k];
+        }
+        // Options on the job line come last so they win over the defaults
+        for (int k = 7; k < num_tokens; k++) {
+            if (strncmp(tokens[k], "--threads=", 10) == 0)
+                job->threads = atoi(tokens[k] + 10);
+            job->argv[job->argc++] = tokens[k];
+        }
+        job->argv[job->argc] = NULL;
+        if (job->threads < 1)
+            job->threads = 1;
+        num_jobs++;
+    }
+    fclose(manifest);
+
+    printf("Manifest: %d jobs on %ld cores\n", num_jobs, cores);
+    fflush(stdout);
+
+    int next_job = 0, running = 0, busy_cores = 0, failed = 0;
+    while (next_job < num_jobs || running > 0) {
+        // Start jobs while their threads fit in the free cores (an oversized
+        // job still starts once the pool is empty)
+        while (next_job < num_jobs && (running == 0 || busy_cores + jobs[next_job].threads <= cores)) {
+            Job* job = &jobs[next_job];
+            clock_gettime(CLOCK_MONOTONIC, &job->start);
+            fflush(stdout);
+            job->pid = fork();
+            if (job->pid == 0) {
+                if (freopen(job->output_path, "w", stdout) == NULL) {
+                    perror("Error opening the job output");
+                    _exit(1);
+                }
+                int status = run_job(job->argc, job->argv);
+                fflush(stdout);
+                _exit(status);
+            }
+            if (job->pid < 0) {
+                perror("Error starting job");
+                job->status = -1;
+                failed++;
+            } else {
+                running++;
+                busy_cores += job->threads;
+            }
+            next_job++;
+        }
 
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0)
+            break;
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        for (int j = 0; j < next_job; j++) {
+            if (jobs[j].pid == pid) {
+                jobs[j].status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+                jobs[j].seconds = elapsed_seconds(jobs[j].start, end);
+                if (jobs[j].status != 0)
+                    failed++;
+                running--;
+                busy_cores -= jobs[j].threads;
+                printf("Job %d: %s -> %s, %d threads, exit %d, %f seconds\n", j, jobs[j].argv[1], jobs[j].output_path,
+                       jobs[j].threads, jobs[j].status, jobs[j].seconds);
+                fflush(stdout);
+                break;
+            }
+        }
+    }
 
+    printf("Manifest done: %d of %d jobs failed\n", failed, num_jobs);
+    free(jobs);
+    return failed > 0 ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc >= 2 && strncmp(argv[1], "--manifest=", 11) == 0)
+        return run_manifest(argv[0], argv[1] + 11, argc - 2, argv + 2);
+    return run_job(argc, argv);
+}
@@ -46,10 +46,10 @@ typedef struct {
 
 // Function to choose the next action based on the epsilon-greedy policy
 int choose_action(unsigned int *rand_seed, int state) {
-    double rand_val = (double)custom_rand(rand_seed) / RAND_MAX;
+    double rand_val = custom_rand(rand_seed) / 4294967296.0;  // Uniform in [0, 1)
     if (rand_val < EPSILON) {
         // Exploration: choose a random action
-        return rand() % NUM_ACTIONS;
+        return custom_rand(rand_seed) % NUM_ACTIONS;
     } else {
         // Exploitation: choose the best action based on the Q-table
         int best_action = 0;